@@ -0,0 +1,104 @@
+//==--- ASTCache.h - On-disk cache of parsed programs -----------------------==//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_ASTCACHE_H
+#define AST_INTERPRETER_ASTCACHE_H
+
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "clang/Basic/Diagnostic.h"
+#include "clang/Basic/DiagnosticOptions.h"
+#include "clang/Basic/FileSystemOptions.h"
+#include "clang/Basic/Version.h"
+#include "clang/Frontend/ASTUnit.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Serialization/PCHContainerOperations.h"
+#include "clang/Tooling/Tooling.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA1.h"
+
+#include "Trace.h"
+
+using namespace clang;
+
+/// Keeps the ASTs of the programs run before as serialized AST files, so a
+/// program that is run again skips lexing, parsing and Sema.
+///
+/// A file is named after the SHA1 of the Clang version, the compiler
+/// arguments and the source text, so it can only ever be loaded for exactly
+/// the source it was built from. Unreadable or stale files are rebuilt.
+class ASTCache {
+  std::string mDir;
+
+  std::string pathOf(llvm::StringRef code, const char *ext = ".ast") const {
+    llvm::SmallString<128> path(mDir);
+    llvm::sys::path::append(path, hashOf(code) + ext);
+    return path.str().str();
+  }
+
+  std::unique_ptr<ASTUnit> load(const std::string &path) {
+    /// the name already proves the AST matches the source, and the source
+    /// was never a real file that could be checked
+    setenv("LIBCLANG_DISABLE_PCH_VALIDATION", "1", 0);
+    llvm::IntrusiveRefCntPtr<DiagnosticsEngine> diags =
+        CompilerInstance::createDiagnostics(new DiagnosticOptions(),
+                                            new IgnoringDiagConsumer());
+    return ASTUnit::LoadFromASTFile(path, RawPCHContainerReader(),
+                                    ASTUnit::LoadEverything, diags,
+                                    FileSystemOptions());
+  }
+
+public:
+  explicit ASTCache(llvm::StringRef dir) : mDir(dir) {}
+
+  /// what `runToolOnCode` compiles a program with
+  static const char *fileName() { return "input.cc"; }
+  static std::vector<std::string> args() { return std::vector<std::string>(); }
+
+  /// the SHA1 of everything the AST of \p code depends on, in hex
+  static std::string hashOf(llvm::StringRef code) {
+    llvm::SHA1 hasher;
+    hasher.update(getClangFullVersion());
+    for (const std::string &arg : args()) {
+      hasher.update(arg);
+      hasher.update(llvm::StringRef("\0", 1));
+    }
+    hasher.update(fileName());
+    hasher.update(llvm::StringRef("\0", 1));
+    hasher.update(code);
+    return llvm::toHex(hasher.result(), true);
+  }
+
+  /// where the InitImage of \p code is kept (`--snapshot`), next to its AST
+  std::string imagePathOf(llvm::StringRef code) const {
+    return pathOf(code, ".init");
+  }
+
+  /// the AST of \p code, parsed only if it is not in the cache yet; null if
+  /// it cannot be parsed at all
+  std::unique_ptr<ASTUnit> get(llvm::StringRef code) {
+    std::string path = pathOf(code);
+    if (llvm::sys::fs::exists(path)) {
+      if (std::unique_ptr<ASTUnit> unit = load(path)) {
+        ASTI_TRACE(TL_Info, "AST cache hit: " << path << "\n");
+        return unit;
+      }
+    }
+    ASTI_TRACE(TL_Info, "AST cache miss: " << path << "\n");
+    std::unique_ptr<ASTUnit> unit =
+        tooling::buildASTFromCodeWithArgs(code, args(), fileName());
+    if (!unit || unit->getDiagnostics().hasErrorOccurred())
+      return unit;
+    /// Save writes a temporary file and renames it, so concurrent runs
+    /// never see half a file
+    if (llvm::sys::fs::create_directories(mDir) || unit->Save(path))
+      llvm::errs() << "warning: cannot write the AST cache " << path << "\n";
+    return unit;
+  }
+};
+
+#endif
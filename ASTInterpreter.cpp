@@ -6,68 +6,210 @@
 #include "clang/AST/EvaluatedExprVisitor.h"
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/FrontendAction.h"
+#include "clang/Tooling/CompilationDatabase.h"
 #include "clang/Tooling/Tooling.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
 
+#include <cstring>
+#include <fcntl.h>
 #include <iostream>
+#include <thread>
+#include <unistd.h>
 
 using namespace clang;
 
+#include "ASTCache.h"
+#include "BytecodeVM.h"
+#include "Daemon.h"
 #include "Environment.h"
+#include "Options.h"
+#include "Sampler.h"
+#include "Tier.h"
 
 #define DEBUG_FLAG 1
 
 class InterpreterVisitor : public EvaluatedExprVisitor<InterpreterVisitor> {
 public:
   explicit InterpreterVisitor(const ASTContext &context, Environment *env)
-      : EvaluatedExprVisitor(context), mEnv(env) {
+      : EvaluatedExprVisitor(context), mEnv(env), mCompletion(CK_Normal),
+        mProfiler(nullptr), mTier(nullptr) {
         env->setInterpreter(this);
       }
   virtual ~InterpreterVisitor() {}
 
+  void setProfiler(Profiler *profiler) { mProfiler = profiler; }
+  void setTiering(Tiering *tier) { mTier = tier; }
+
+  /// Statements (and the conditions of if/loops) are visited through here;
+  /// the expressions inside them go straight to EvaluatedExprVisitor::Visit,
+  /// so `--profile` times statements without slowing down the others.
+  void Visit(Stmt *stmt) {
+    if (!mProfiler) {
+      EvaluatedExprVisitor::Visit(stmt);
+      return;
+    }
+    mProfiler->enterStmt(stmt);
+    EvaluatedExprVisitor::Visit(stmt);
+    mProfiler->leaveStmt();
+  }
+
+  /// Visit \p stmt, the node numbered \p node of the frame on top of the
+  /// stack (see FrameLayout). Every Visit* method takes the number of its
+  /// node from the Environment before it visits anything else.
+  void visit(Stmt *stmt, unsigned node) {
+    mEnv->setCurrentNode(node);
+    this->Visit(stmt);
+  }
+
+  /// Visit the children of \p stmt, numbered \p node. A constant subtree is
+  /// not walked, its value comes from the ConstantFolder, kept by node.
+  void visitChildren(Stmt *stmt, unsigned node) {
+    const FrameLayout &layout = mEnv->stackTop().getLayout();
+    unsigned num = node + 1;
+    for (Stmt *child : stmt->children()) {
+      if (!child)
+        continue;
+      if (const int *value = layout.constant(num)) {
+        mEnv->bindNode(num, *value);
+      } else {
+        mEnv->setCurrentNode(num);
+        EvaluatedExprVisitor::Visit(child);
+      }
+      num = layout.next(num);
+    }
+  }
+  void VisitStmt(Stmt *stmt) { visitChildren(stmt, mEnv->getCurrentNode()); }
+
   virtual void VisitBinaryOperator(BinaryOperator *bop) {
-    VisitStmt(bop);
-    mEnv->binop(bop);
+    unsigned node = mEnv->getCurrentNode();
+    visitChildren(bop, node);
+    mEnv->binop(bop, node);
   }
 
   virtual void VisitUnaryOperator(UnaryOperator * uop) {
-    VisitStmt(uop);
-    mEnv->uop(uop);
+    unsigned node = mEnv->getCurrentNode();
+    if (uop->getOpcode() == UO_AddrOf) {
+      /// `&a[i]` evaluates `a` and `i`, but must not read `a[i]`
+      Expr *lvalue = uop->getSubExpr()->IgnoreParens();
+      visitChildren(lvalue,
+                    FrameLayout::descend(uop->getSubExpr(), node + 1, lvalue));
+      mEnv->uop(uop, node);
+      return;
+    }
+    visitChildren(uop, node);
+    mEnv->uop(uop, node);
   }
 
   virtual void VisitIntegerLiteral(IntegerLiteral * il) {
     int val = il->getValue().getSExtValue();
-    mEnv->bindStmt(il, val);
+    mEnv->bindNode(mEnv->getCurrentNode(), val);
   }
 
   virtual void VisitDeclRefExpr(DeclRefExpr *expr) {
-    VisitStmt(expr);
-    mEnv->declref(expr);
+    unsigned node = mEnv->getCurrentNode();
+    visitChildren(expr, node);
+    mEnv->declref(expr, node);
   }
   virtual void VisitCastExpr(CastExpr *expr) {
-    VisitStmt(expr);
-    mEnv->cast(expr);
+    unsigned node = mEnv->getCurrentNode();
+    visitChildren(expr, node);
+    mEnv->cast(expr, node);
+  }
+  /// Run \p call numbered \p node, whose arguments are evaluated, as
+  /// bytecode if its callee is hot and put its return value in \p retVal.
+  bool tierCall(CallExpr *call, unsigned node, int &retVal) {
+    if (!mTier || !call->getDirectCallee())
+      return false;
+    const CallTarget &target = mEnv->getCallTarget(call->getDirectCallee());
+    if (target.mKind != BK_None || !target.mDefinition ||
+        !mTier->hotCall(target.mDefinition))
+      return false;
+    const FrameLayout &layout = mEnv->stackTop().getLayout();
+    llvm::SmallVector<int, 8> args;
+    for (unsigned i = 0, e = call->getNumArgs(), arg = mEnv->firstArg(node);
+         i != e; i++, arg = layout.next(arg))
+      args.push_back(mEnv->getNodeVal(arg));
+    mEnv->stackTop().setPC(call);
+    retVal = mTier->call(target.mDefinition, args.data());
+    return true;
   }
+
+  /// Count a back-edge of \p loop. If it is hot, the rest of the function
+  /// runs as bytecode and the walker unwinds as if it had returned.
+  bool tierLoop(Stmt *loop) {
+    if (!mTier || !mTier->hotLoop(loop, mEnv->stackTop()))
+      return false;
+    mEnv->setRetVal(mTier->resume(loop, mEnv->stackTop()));
+    mCompletion = CK_Return;
+    return true;
+  }
+
   virtual void VisitCallExpr(CallExpr *call) {
-    VisitStmt(call);
-    bool notBuiltin = mEnv->call(call);
+    unsigned node = mEnv->getCurrentNode();
+    visitChildren(call, node);
+    int retVal;
+    if (mEnv->memoLookup(call, node, retVal) ||
+        tierCall(call, node, retVal)) {
+      mEnv->bindNode(node, retVal);
+      return;
+    }
+    bool notBuiltin = mEnv->call(call, node);
     // FunctionDecl * callee = call->getDirectCallee();
-    try {
+    if (notBuiltin) {
       /// visit function body
-      if(notBuiltin)
-        VisitStmt(mEnv->stackTop().getPC());
-    } catch (ReturnException &e) {
-      int retVal = e.getRetVal();
+      retVal = runBody(mEnv->stackTop().getPC());
       mEnv->stackPop();
-      // llvm::outs() << "catch val: " << retVal << "\n";
-      mEnv->stackTop().bindStmt(call, retVal);
+      mEnv->bindNode(node, retVal);
+      /// the arguments are still in the temps of the caller
+      mEnv->memoStore(call, node, retVal);
+    }
+  }
+
+  /// execute the body of the function on top of the stack and return its
+  /// return value (0 if it falls off the end); a body is node 0 of its frame
+  int runBody(Stmt *body) {
+    this->visit(body, 0);
+    /// tail calls replaced the frame, keep going in the same C++ frame
+    while (mCompletion == CK_TailCall) {
+      mCompletion = CK_Normal;
+      this->visit(mEnv->stackTop().getPC(), 0);
+    }
+    int retVal = mCompletion == CK_Return ? mEnv->getRetVal() : 0;
+    mCompletion = CK_Normal;
+    return retVal;
+  }
+
+  virtual void VisitCompoundStmt(CompoundStmt *body) {
+    const FrameLayout &layout = mEnv->stackTop().getLayout();
+    unsigned num = mEnv->getCurrentNode() + 1;
+    for (Stmt *stmt : body->body()) {
+      this->visit(stmt, num);
+      if (mCompletion != CK_Normal) return;
+      num = layout.next(num);
+    }
+  }
+  virtual void VisitBreakStmt(BreakStmt *) { mCompletion = CK_Break; }
+  virtual void VisitContinueStmt(ContinueStmt *) { mCompletion = CK_Continue; }
+
+  /// after the body of a loop ran: returns true if the loop has to stop
+  bool leaveLoop() {
+    if (mCompletion == CK_Break) {
+      mCompletion = CK_Normal;
+      return true;
     }
+    if (mCompletion == CK_Continue)
+      mCompletion = CK_Normal;
+    /// a return keeps unwinding
+    return mCompletion != CK_Normal;
   }
+
   virtual void VisitDeclStmt(DeclStmt *declstmt) {
 #if DEBUG_FLAG
     // llvm::outs() << "VisitDeclStmt" << "\n";
 #endif
     // VisitStmt(declstmt);
-    mEnv->decl(declstmt);
+    mEnv->decl(declstmt, mEnv->getCurrentNode());
   }
 
   int getChildrenSize(Stmt * stmt) {
@@ -82,8 +224,9 @@ public:
   virtual void VisitArraySubscriptExpr(ArraySubscriptExpr * arrsubexpr) {
     // arrsubexpr->dump();
     // llvm::outs() << "children size=" << getChildrenSize(arrsubexpr) << "\n";
-    VisitStmt(arrsubexpr);
-    mEnv->arraysub(arrsubexpr);
+    unsigned node = mEnv->getCurrentNode();
+    visitChildren(arrsubexpr, node);
+    mEnv->arraysub(arrsubexpr, node);
   }
 
   // virtual void VisitParmVarDecl(ParmVarDecl * parmdecl) {
@@ -94,149 +237,662 @@ public:
   // }
 
   virtual void VisitReturnStmt(ReturnStmt *retstmt) {
-    VisitStmt(retstmt);
-    mEnv->retrn(retstmt);
+    unsigned node = mEnv->getCurrentNode();
+    if (mEnv->isTailCall(retstmt)) {
+      CallExpr *call = Resolver::callOf(retstmt);
+      unsigned callNode = FrameLayout::descend(retstmt, node, call);
+      visitChildren(call, callNode);
+      int tierRetVal;
+      /// memoized callees are never tail called, see Environment::isTailCall
+      if (tierCall(call, callNode, tierRetVal)) {
+        mEnv->setRetVal(tierRetVal);
+        mCompletion = CK_Return;
+        return;
+      }
+      mEnv->tailCall(call, callNode);
+      mCompletion = CK_TailCall;
+      return;
+    }
+    visitChildren(retstmt, node);
+    mEnv->retrn(retstmt, node);
+    mCompletion = CK_Return;
   }
 
   virtual void VisitIfStmt(IfStmt *ifstmt) {
+    unsigned node = mEnv->getCurrentNode();
+    const FrameLayout &layout = mEnv->stackTop().getLayout();
     Expr *condExpr = ifstmt->getCond();
-    this->Visit(condExpr);
-    int cond = mEnv->stackTop().getStmtVal(condExpr);
+    unsigned condNode = layout.childOf(ifstmt, node, condExpr);
+    int cond;
+    if (const int *folded = layout.constant(condNode)) {
+      cond = *folded;
+    } else {
+      this->visit(condExpr, condNode);
+      cond = mEnv->getNodeVal(condNode);
+    }
     if (cond) {
       // llvm::outs() << "then branch\n";
-      if (ifstmt->getThen()) this->Visit(ifstmt->getThen());
+      if (Stmt *then = ifstmt->getThen())
+        this->visit(then, layout.childOf(ifstmt, node, then));
     } else {
-      if (ifstmt->getElse()) this->Visit(ifstmt->getElse());
+      if (Stmt *otherwise = ifstmt->getElse())
+        this->visit(otherwise, layout.childOf(ifstmt, node, otherwise));
       // llvm::outs() << "else branch\n";
     }
   }
 
   virtual void VisitWhileStmt(WhileStmt * wstmt) {
+    unsigned node = mEnv->getCurrentNode();
+    const FrameLayout &layout = mEnv->stackTop().getLayout();
     Expr * condExpr = wstmt->getCond();
+    unsigned condNode = layout.childOf(wstmt, node, condExpr);
+    /// `while (1)` checks nothing, `while (0)` never runs
+    const int *folded = layout.constant(condNode);
+    if (folded && !*folded)
+      return;
+    unsigned bodyNode = layout.childOf(wstmt, node, wstmt->getBody());
     do {
-      this->Visit(condExpr);
-      int cond = mEnv->getStmtVal(condExpr);
-      if(!cond) break;
-      this->Visit(wstmt->getBody());
+      if (!folded) {
+        this->visit(condExpr, condNode);
+        int cond = mEnv->getNodeVal(condNode);
+        if(!cond) break;
+      }
+      this->visit(wstmt->getBody(), bodyNode);
+      if (leaveLoop()) break;
+      if (tierLoop(wstmt)) return;
     } while (true);
   }
 
   virtual void VisitForStmt(ForStmt * fstmt) {
+    unsigned node = mEnv->getCurrentNode();
+    const FrameLayout &layout = mEnv->stackTop().getLayout();
     Stmt * initstmt = fstmt->getInit();
-    if (initstmt) this->Visit(initstmt);
+    if (initstmt) this->visit(initstmt, layout.childOf(fstmt, node, initstmt));
+    /// fills, copies, sums and searches over arrays run in one go
+    int idiom = mEnv->getIdioms().lookup(fstmt);
+    StackFrame &frame = mEnv->stackTop();
+    if (idiom >= 0 &&
+        mEnv->runIdiom(idiom, frame.slotData(), frame.getMemBase()))
+      return;
     Expr * condExpr = fstmt->getCond();
+    unsigned condNode = condExpr ? layout.childOf(fstmt, node, condExpr) : 0;
+    const int *folded = condExpr ? layout.constant(condNode) : nullptr;
+    if (folded) {
+      if (!*folded)
+        return;
+      /// always true, like a missing condition
+      condExpr = nullptr;
+    }
+    unsigned bodyNode = layout.childOf(fstmt, node, fstmt->getBody());
+    Expr *inc = fstmt->getInc();
+    unsigned incNode = inc ? layout.childOf(fstmt, node, inc) : 0;
     do {
-      this->Visit(condExpr);
-      int cond = mEnv->getStmtVal(condExpr);
-      if(!cond) break;
-      this->Visit(fstmt->getBody());
-      this->Visit(fstmt->getInc());
+      if (condExpr) {
+        this->visit(condExpr, condNode);
+        int cond = mEnv->getNodeVal(condNode);
+        if(!cond) break;
+      }
+      this->visit(fstmt->getBody(), bodyNode);
+      if (leaveLoop()) break;
+      if (inc) this->visit(inc, incNode);
+      if (tierLoop(fstmt)) return;
     } while (true);
   }
 
   virtual void VisitCStyleCastExpr(CStyleCastExpr * ccastexpr) {
-    this->VisitStmt(ccastexpr);
-    stealBindingFromChild(ccastexpr);
+    unsigned node = mEnv->getCurrentNode();
+    this->visitChildren(ccastexpr, node);
+    stealBindingFromChild(ccastexpr, node);
   }
   virtual void VisitImplicitCastExpr(ImplicitCastExpr * icastexpr) {
     // llvm::outs() << "implict cast\n";
-    this->VisitStmt(icastexpr);
-    stealBindingFromChild(icastexpr);
+    unsigned node = mEnv->getCurrentNode();
+    this->visitChildren(icastexpr, node);
+    stealBindingFromChild(icastexpr, node);
   }
   virtual void VisitParenExpr(ParenExpr * parenexpr) {
-    this->VisitStmt(parenexpr);
-    stealBindingFromChild(parenexpr);
+    unsigned node = mEnv->getCurrentNode();
+    this->visitChildren(parenexpr, node);
+    stealBindingFromChild(parenexpr, node);
   } 
   /// for some AST(e.g., ImplicitCastExpr, CStyleCastExpr), we need to have their "value" binding.
   /// so we steal the value binding from their children. Usually, they have only one child.
-  void stealBindingFromChild(Stmt * parent) {
+  void stealBindingFromChild(Stmt * parent, unsigned node) {
     Stmt * stmt = nullptr;
     for(auto c:parent->children()) {
       stmt = c;break;
     }
     
+    /// children without a value (e.g. a function name) just leave an
+    /// unused temporary behind; the first child is the next node
     if(stmt) {
-      if(mEnv->stackTop().hasStmt(stmt)) {
-        mEnv->bindStmt(parent, mEnv->stackTop().getStmtVal(stmt));
-        // llvm::outs() << "succ\n";
-        // stmt->dump();
-        return;
-      }
-    //   if(DeclRefExpr * declref = dyn_cast<DeclRefExpr>(stmt)) {
-    //     if(!declref->getType()->isFunctionType()/*!mEnv->isBuiltInDecl(declref)*/) {
-    //       // stmt->dump();
-    //       mEnv->bindStmt(icastexpr, mEnv->stackTop().getStmtVal(stmt));
-    //     }
-    //   } else if(ArraySubscriptExpr * arrsub = dyn_cast<ArraySubscriptExpr>(stmt)) {
-    //       // stmt->dump();
-    //       mEnv->bindStmt(icastexpr, mEnv->stackTop().getStmtVal(stmt));
-    //   }
+      mEnv->bindNode(node, mEnv->getNodeVal(node + 1));
     }
-    // llvm::outs() << "fail\n";
-    // stmt->dump();
   }
 
   virtual void VisitUnaryExprOrTypeTraitExpr(UnaryExprOrTypeTraitExpr * uexpr) {
-    this->VisitStmt(uexpr);
+    unsigned node = mEnv->getCurrentNode();
+    this->visitChildren(uexpr, node);
     /// we assume the op must be `sizeof` 
     // uexpr->getExprStmt()->dump();
-    auto argType = uexpr->getArgumentTypeInfo()->getType();
-    int sz = 0;
-    if(argType->isPointerType()) {
-      sz = sizeof(Heap::HeapAddr);
-    } else if(argType->isIntegerType()) {
-      sz = sizeof(int);
-    } else {
-      llvm::outs() << "Unknown Type:\n";
-      argType.dump();
-      throw std::exception();
-    }
-    mEnv->bindStmt(uexpr, sz);
+    mEnv->bindNode(node, typeSize(uexpr->getTypeOfArgument()));
   }
 private:
   Environment *mEnv;
+  /// how the statement executed last completed
+  Completion mCompletion;
+  Profiler *mProfiler;
+  /// promotes hot functions and loops to bytecode, null if disabled
+  Tiering *mTier;
 };
 
 class InterpreterConsumer : public ASTConsumer {
 public:
-  explicit InterpreterConsumer(const ASTContext &context)
-      : mEnv(), mVisitor(context, &mEnv) {}
+  /// the program's GET reads \p inFd and PRINT writes \p outFd; `--stats`
+  /// and the profiles are reported on \p report
+  explicit InterpreterConsumer(const ASTContext &context,
+                               const InterpreterOptions &options,
+                               int inFd = 0, int outFd = 2,
+                               llvm::raw_ostream &report = llvm::outs())
+      : mEnv(options.mStackSize << 20, inFd, outFd), mVisitor(context, &mEnv),
+        mOptions(options), mReport(report), mExitCode(0),
+        mRestoreImage(nullptr), mSaveImage(nullptr), mRestored(false) {
+    if (options.mProfile) {
+      mProfiler.reset(new Profiler(context.getSourceManager()));
+      mEnv.setProfiler(mProfiler.get());
+      mVisitor.setProfiler(mProfiler.get());
+    }
+    if (options.mSample)
+      mSampler.reset(new Sampler(mEnv, context.getSourceManager(),
+                                 options.mSampleInterval));
+    if (options.mMemoSize)
+      mEnv.enableMemo(options.mMemoSize);
+  }
   virtual ~InterpreterConsumer() {}
 
+  /// start from \p restore instead of running the global initializers, if
+  /// it fits; otherwise save what they leave into \p save (`--snapshot`)
+  void setInitImages(const InitImage *restore, InitImage *save) {
+    mRestoreImage = restore;
+    mSaveImage = save;
+  }
+  /// the global initializers were not run, the state came from an image
+  bool restoredInit() const { return mRestored; }
+
   virtual void HandleTranslationUnit(clang::ASTContext &Context) {
+    try {
+      run(Context);
+    } catch (...) {
+      /// keep what the program printed before it failed
+      mEnv.getIO().flush();
+      throw;
+    }
+    mEnv.getIO().flush();
+    if (mOptions.mStats) {
+      mReport << "stats: nodes=" << mEnv.getNodes() << "\n";
+      /// whether `--snapshot` took the state after the global initializers
+      /// from an image or ran them
+      if (mRestoreImage || mSaveImage)
+        mReport << "stats: init=" << (mRestored ? "restored" : "ran") << "\n";
+      if (mTier)
+        mTier->printStats(mReport);
+      mEnv.printMemoStats(mReport);
+    }
+    if (mProfiler) {
+      mProfiler->finish();
+      report(*mProfiler, mOptions.mProfileStacks, mReport);
+    }
+    if (mSampler)
+      report(*mSampler, mOptions.mSampleStacks, mReport);
+  }
+
+  /// the summary of \p profiler on \p os, its collapsed stacks in
+  /// \p stacksFile if one was given
+  template <typename ProfilerT>
+  static void report(const ProfilerT &profiler, const std::string &stacksFile,
+                     llvm::raw_ostream &os) {
+    profiler.printSummary(os, PROFILE_TOP);
+    if (stacksFile.empty())
+      return;
+    std::error_code error;
+    llvm::raw_fd_ostream stacks(stacksFile, error, llvm::sys::fs::OF_None);
+    if (error) {
+      llvm::errs() << "warning: cannot write " << stacksFile << ": "
+                   << error.message() << "\n";
+      return;
+    }
+    profiler.printCollapsedStacks(stacks);
+  }
+
+  void run(clang::ASTContext &Context) {
     TranslationUnitDecl *decl = Context.getTranslationUnitDecl();
-    mEnv.init(decl);
+    for (const std::string &lib : mOptions.mNativeLibs)
+      if (!mEnv.getBuiltins().loadLibrary(lib))
+        throw std::exception();
+    mRestored = mEnv.init(decl, mRestoreImage, mSaveImage);
 
     FunctionDecl *entry = mEnv.getEntry();
-    try {
-      mVisitor.VisitStmt(entry->getBody());
-    } catch (ReturnException & e) {
-      /// catch main return value
-      if(e.getRetVal() != 0) {
-        llvm::outs() << "main exit with a non-zero code!\n";
+    if (mOptions.mBytecode && !mOptions.needsWalker()) {
+      BytecodeVM vm(mEnv, mOptions.mJIT);
+      mExitCode = vm.run(entry);
+    } else {
+      /// profiling measures the walker and memoized calls must stay in it,
+      /// nothing is promoted
+      if (mOptions.mTierThreshold && !mOptions.needsWalker()) {
+        mTier.reset(new Tiering(mEnv, mOptions.mTierThreshold));
+        mVisitor.setTiering(mTier.get());
       }
+      if (mSampler)
+        mSampler->start();
+      mEnv.stackPush(entry);
+      mExitCode = mVisitor.runBody(entry->getBody());
+      if (mSampler)
+        mSampler->stop();
+    }
+    if (mExitCode != 0) {
+      mReport << "main exit with a non-zero code!\n";
     }
   }
 
+  /// what `main` returned
+  int getExitCode() const { return mExitCode; }
+
 private:
+  /// functions and statements (or lines) `--profile` and `--sample` list
+  static const unsigned PROFILE_TOP = 20;
+
   Environment mEnv;
   InterpreterVisitor mVisitor;
+  InterpreterOptions mOptions;
+  llvm::raw_ostream &mReport;
+  int mExitCode;
+  const InitImage *mRestoreImage;
+  InitImage *mSaveImage;
+  bool mRestored;
+  std::unique_ptr<Profiler> mProfiler;
+  std::unique_ptr<Sampler> mSampler;
+  std::unique_ptr<Tiering> mTier;
 };
 
 class InterpreterClassAction : public ASTFrontendAction {
 public:
+  explicit InterpreterClassAction(const InterpreterOptions &options)
+      : mOptions(options) {}
+
   virtual std::unique_ptr<clang::ASTConsumer>
   CreateASTConsumer(clang::CompilerInstance &Compiler, llvm::StringRef InFile) {
     return std::unique_ptr<clang::ASTConsumer>(
-        new InterpreterConsumer(Compiler.getASTContext()));
+        new InterpreterConsumer(Compiler.getASTContext(), mOptions));
+  }
+
+private:
+  InterpreterOptions mOptions;
+};
+
+/// The files of one program of a batch: GET reads `<file>.in` if there is
+/// one, PRINT writes `<file>.out`. It is a base of BatchConsumer, so the
+/// files are closed only after the Environment flushed into them.
+struct BatchFiles {
+  int mInFd;
+  int mOutFd;
+
+  explicit BatchFiles(const std::string &file)
+      : mInFd(open((file + ".in").c_str(), O_RDONLY)),
+        mOutFd(open((file + ".out").c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                    0644)) {
+    if (mInFd < 0)
+      mInFd = open("/dev/null", O_RDONLY);
+    if (mOutFd < 0)
+      llvm::errs() << "warning: cannot write " << file << ".out\n";
+  }
+  ~BatchFiles() {
+    close(mInFd);
+    if (mOutFd >= 0)
+      close(mOutFd);
+  }
+};
+
+/// Runs one program of a batch with its own Environment and reports
+/// `<file>: exit <code>` on stdout, or `<file>: error` if it could not be
+/// compiled or interpreted.
+class BatchConsumer : private BatchFiles, public InterpreterConsumer {
+  std::string mFile;
+  unsigned &mFailed;
+
+  void fail() {
+    llvm::outs() << mFile << ": error\n";
+    mFailed++;
+  }
+
+public:
+  BatchConsumer(const ASTContext &context, const InterpreterOptions &options,
+                const std::string &file, unsigned &failed)
+      : BatchFiles(file), InterpreterConsumer(context, options, mInFd, mOutFd),
+        mFile(file), mFailed(failed) {}
+
+  virtual void HandleTranslationUnit(clang::ASTContext &Context) {
+    if (Context.getDiagnostics().hasErrorOccurred())
+      return fail();
+    try {
+      InterpreterConsumer::HandleTranslationUnit(Context);
+    } catch (...) {
+      return fail();
+    }
+    llvm::outs() << mFile << ": exit " << getExitCode() << "\n";
+  }
+};
+
+class BatchAction : public ASTFrontendAction {
+public:
+  BatchAction(const InterpreterOptions &options, unsigned &failed)
+      : mOptions(options), mFailed(failed) {}
+
+  virtual std::unique_ptr<clang::ASTConsumer>
+  CreateASTConsumer(clang::CompilerInstance &Compiler, llvm::StringRef InFile) {
+    return std::unique_ptr<clang::ASTConsumer>(new BatchConsumer(
+        Compiler.getASTContext(), mOptions, InFile.str(), mFailed));
+  }
+
+private:
+  InterpreterOptions mOptions;
+  unsigned &mFailed;
+};
+
+class BatchActionFactory : public tooling::FrontendActionFactory {
+public:
+  explicit BatchActionFactory(const InterpreterOptions &options)
+      : mOptions(options), mFailed(0) {}
+
+  virtual std::unique_ptr<FrontendAction> create() {
+    return std::unique_ptr<FrontendAction>(new BatchAction(mOptions, mFailed));
   }
+
+  /// programs that could not be compiled or interpreted
+  unsigned getFailed() const { return mFailed; }
+
+private:
+  InterpreterOptions mOptions;
+  unsigned mFailed;
 };
 
+/// Interpret every file of \p files in this process. One ClangTool, and so
+/// one FileManager, serves all of them; each program gets a fresh
+/// Environment.
+static int runBatch(const std::vector<std::string> &files,
+                    const InterpreterOptions &options) {
+  /// parse as C++ like runToolOnCode's input.cc does
+  tooling::FixedCompilationDatabase db(".", std::vector<std::string>{"-xc++"});
+  tooling::ClangTool tool(db, files);
+  BatchActionFactory factory(options);
+  int ret = tool.run(&factory);
+  return ret || factory.getFailed() ? 1 : 0;
+}
+
+static void usage() {
+  llvm::errs()
+      << "usage: ast-interpreter [--bytecode] [--jit] [--stack-size=<MB>] "
+         "[--stats]\n"
+      << "                       [--profile[=<stacks file>]]\n"
+      << "                       [--sample[=<stacks file>]] "
+         "[--sample-interval=<us>]\n"
+      << "                       [--tier-threshold=<n>] [--memo[=<entries>]]\n"
+      << "                       [--ast-cache=<dir>] [--trace=off|info|trace]\n"
+      << "                       [--native=<lib.so>]... [--snapshot]\n"
+      << "                       <code> | --file=<file> | --batch <file>...\n"
+      << "       ast-interpreter [options] --serve=<socket> [--workers=<n>] "
+         "[--cached-programs=<n>]\n"
+      << "       ast-interpreter --connect=<socket> <code> | --file=<file>\n";
+}
+
+/// like runToolOnCode, but takes the AST from \p options.mASTCache if the
+/// same code was run before, and with `--snapshot` the state after the
+/// global initializers too
+static int runCached(llvm::StringRef code, const InterpreterOptions &options) {
+  ASTCache cache(options.mASTCache);
+  std::unique_ptr<ASTUnit> unit = cache.get(code);
+  if (!unit)
+    return 1;
+  InterpreterConsumer consumer(unit->getASTContext(), options);
+  InitImage saved, fresh;
+  bool loaded = false;
+  if (options.mSnapshot) {
+    loaded = saved.load(cache.imagePathOf(code));
+    consumer.setInitImages(loaded ? &saved : nullptr, &fresh);
+  }
+  consumer.HandleTranslationUnit(unit->getASTContext());
+  /// an invalid image on disk records that the initializers have effects,
+  /// a valid one that did not fit is replaced
+  if (options.mSnapshot && !consumer.restoredInit() &&
+      (!loaded || saved.mValid) && !fresh.save(cache.imagePathOf(code)))
+    llvm::errs() << "warning: cannot write the snapshot "
+                 << cache.imagePathOf(code) << "\n";
+  return 0;
+}
+
+/// Run a job of `--serve` like runCached runs a program; other workers may
+/// be running the same \p program meanwhile, the interpreter only reads it
+static void runJob(Program &program, const InterpreterOptions &options,
+                   int inFd, int outFd, JobResult &result) {
+  ASTContext &context = program.getASTContext();
+  std::shared_ptr<const InitImage> image;
+  std::shared_ptr<InitImage> fresh;
+  if (options.mSnapshot && !(image = program.getImage()))
+    fresh = std::make_shared<InitImage>();
+  llvm::raw_string_ostream report(result.mOut);
+  try {
+    /// the walker recurses on the stack of the worker, the Environment
+    /// does not need to be there too
+    std::unique_ptr<InterpreterConsumer> consumer(
+        new InterpreterConsumer(context, options, inFd, outFd, report));
+    consumer->setInitImages(image.get(), fresh.get());
+    consumer->HandleTranslationUnit(context);
+    result.mExitCode = consumer->getExitCode();
+    if (fresh)
+      program.setImage(fresh);
+  } catch (...) {
+    result.mStatus = 1;
+  }
+  report.flush();
+}
+
+/// `--connect`: run \p code on the server at \p path, with all of stdin as
+/// its input, and print what it printed as if it had run here
+static int runRemote(const std::string &path, llvm::StringRef code) {
+  Job job;
+  job.mProgram = code.str();
+  /// there is no one to answer GET over the socket
+  if (!isatty(0)) {
+    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> input =
+        llvm::MemoryBuffer::getSTDIN();
+    if (!input) {
+      llvm::errs() << "cannot read stdin: " << input.getError().message()
+                   << "\n";
+      return 1;
+    }
+    job.mInput = (*input)->getBuffer().str();
+  }
+  JobResult result;
+  if (!Daemon::submit(path, job, result)) {
+    llvm::errs() << "cannot run the program on " << path << "\n";
+    return 1;
+  }
+  llvm::errs() << result.mErr;
+  llvm::outs() << result.mOut;
+  return result.mStatus;
+}
+
+static bool parseTraceLevel(llvm::StringRef name) {
+  TraceLevel level;
+  if (name == "off") level = TL_Off;
+  else if (name == "info") level = TL_Info;
+  else if (name == "trace") level = TL_Trace;
+  else return false;
+  if (level > ASTI_MAX_TRACE_LEVEL)
+    llvm::errs() << "warning: built without --trace=" << name
+                 << " support, reconfigure with -DASTI_TRACE=" << name << "\n";
+  traceLevel() = level;
+  return true;
+}
+
 int main(int argc, char **argv) {
-  if (argc > 1) {
-    clang::tooling::runToolOnCode(
-        std::unique_ptr<clang::FrontendAction>(new InterpreterClassAction),
-        argv[1]);
+  InterpreterOptions options;
+  bool batch = false;
+  std::string file;
+  /// `--serve` and `--connect`
+  std::string serve, connect;
+  unsigned workers = std::thread::hardware_concurrency();
+  unsigned programs = 64;
+  std::vector<std::string> inputs;
+  for (int i = 1; i < argc; i++) {
+    llvm::StringRef arg(argv[i]);
+    if (arg == "--bytecode") {
+      options.mBytecode = true;
+    } else if (arg == "--jit") {
+      /// the JIT compiles bytecode
+      options.mBytecode = true;
+      options.mJIT = true;
+      if (!ASTI_JIT)
+        llvm::errs() << "warning: built without --jit support, reconfigure "
+                        "with -DASTI_JIT=ON\n";
+    } else if (arg.startswith("--stack-size=")) {
+      llvm::StringRef size = arg.substr(strlen("--stack-size="));
+      if (size.getAsInteger(10, options.mStackSize) || options.mStackSize == 0) {
+        usage();
+        return 1;
+      }
+    } else if (arg == "--profile") {
+      options.mProfile = true;
+    } else if (arg.startswith("--profile=")) {
+      options.mProfile = true;
+      options.mProfileStacks = arg.substr(strlen("--profile=")).str();
+    } else if (arg == "--sample") {
+      options.mSample = true;
+    } else if (arg.startswith("--sample=")) {
+      options.mSample = true;
+      options.mSampleStacks = arg.substr(strlen("--sample=")).str();
+    } else if (arg.startswith("--sample-interval=")) {
+      if (arg.substr(strlen("--sample-interval="))
+              .getAsInteger(10, options.mSampleInterval) ||
+          options.mSampleInterval == 0) {
+        usage();
+        return 1;
+      }
+    } else if (arg.startswith("--native=")) {
+      options.mNativeLibs.push_back(arg.substr(strlen("--native=")).str());
+    } else if (arg.startswith("--tier-threshold=")) {
+      if (arg.substr(strlen("--tier-threshold="))
+              .getAsInteger(10, options.mTierThreshold)) {
+        usage();
+        return 1;
+      }
+    } else if (arg == "--memo") {
+      options.mMemoSize = InterpreterOptions::DEFAULT_MEMO_SIZE;
+    } else if (arg.startswith("--memo=")) {
+      if (arg.substr(strlen("--memo=")).getAsInteger(10, options.mMemoSize) ||
+          !options.mMemoSize) {
+        usage();
+        return 1;
+      }
+    } else if (arg == "--snapshot") {
+      options.mSnapshot = true;
+    } else if (arg == "--stats") {
+      options.mStats = true;
+    } else if (arg == "--batch") {
+      batch = true;
+    } else if (arg.startswith("--file=")) {
+      file = arg.substr(strlen("--file=")).str();
+    } else if (arg.startswith("--serve=")) {
+      serve = arg.substr(strlen("--serve=")).str();
+    } else if (arg.startswith("--connect=")) {
+      connect = arg.substr(strlen("--connect=")).str();
+    } else if (arg.startswith("--workers=")) {
+      if (arg.substr(strlen("--workers=")).getAsInteger(10, workers) ||
+          !workers) {
+        usage();
+        return 1;
+      }
+    } else if (arg.startswith("--cached-programs=")) {
+      if (arg.substr(strlen("--cached-programs="))
+              .getAsInteger(10, programs) ||
+          !programs) {
+        usage();
+        return 1;
+      }
+    } else if (arg.startswith("--ast-cache=")) {
+      options.mASTCache = arg.substr(strlen("--ast-cache=")).str();
+    } else if (arg.startswith("--trace=")) {
+      if (!parseTraceLevel(arg.substr(strlen("--trace=")))) {
+        usage();
+        return 1;
+      }
+    } else if (arg.startswith("--")) {
+      usage();
+      return 1;
+    } else {
+      inputs.push_back(argv[i]);
+    }
+  }
+  if (options.needsWalker() && options.mBytecode)
+    llvm::errs() << "warning: --profile, --sample and --memo need the AST "
+                    "walker, --bytecode is ignored\n";
+  if (options.mSnapshot && options.mASTCache.empty() && serve.empty())
+    llvm::errs() << "warning: --snapshot needs --ast-cache or --serve, it is "
+                    "ignored\n";
+  if (batch) {
+    if (inputs.empty() || !file.empty() || !options.mASTCache.empty()) {
+      usage();
+      return 1;
+    }
+    return runBatch(inputs, options);
+  }
+  if (!serve.empty()) {
+    /// the profilers own process-wide timers and signals, and read the
+    /// SourceManager, which the workers would share; the trace goes to the
+    /// shared llvm::outs(), not to the output of the job; the ASTs are
+    /// cached in memory already
+    if (!inputs.empty() || !file.empty() || !connect.empty() ||
+        !options.mASTCache.empty() || options.mProfile || options.mSample ||
+        traceLevel() != TL_Off) {
+      usage();
+      return 1;
+    }
+    Daemon daemon(serve, workers, programs,
+                  [&options](Program &program, int inFd, int outFd,
+                             JobResult &result) {
+                    runJob(program, options, inFd, outFd, result);
+                  });
+    return daemon.serve() ? 0 : 1;
+  }
+  if (!connect.empty() && !options.mASTCache.empty()) {
+    usage();
+    return 1;
+  }
+
+  /// the program text, mapped rather than copied for --file
+  std::unique_ptr<llvm::MemoryBuffer> buffer;
+  llvm::StringRef code;
+  if (!file.empty()) {
+    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> bufferOrErr =
+        llvm::MemoryBuffer::getFile(file);
+    if (!bufferOrErr) {
+      llvm::errs() << "cannot read " << file << ": "
+                   << bufferOrErr.getError().message() << "\n";
+      return 1;
+    }
+    buffer = std::move(*bufferOrErr);
+    code = buffer->getBuffer();
+  } else if (!inputs.empty()) {
+    code = inputs.back();
+  } else {
+    return 0;
   }
+  if (!connect.empty())
+    return runRemote(connect, code);
+  if (!options.mASTCache.empty())
+    return runCached(code, options);
+  clang::tooling::runToolOnCode(
+      std::unique_ptr<clang::FrontendAction>(
+          new InterpreterClassAction(options)),
+      code);
   // std::cout << "Hello sch001\n";
 }
@@ -0,0 +1,123 @@
+//==--- BuiltinIO.h - Buffered I/O of the GET and PRINT built-ins ----------==//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_BUILTINIO_H
+#define AST_INTERPRETER_BUILTINIO_H
+
+#include <cerrno>
+#include <unistd.h>
+
+#include "llvm/Support/raw_ostream.h"
+
+/// PRINT output is collected in a large buffer and written when it fills up
+/// or when the program ends, instead of one unbuffered write per value.
+/// GET parses integers out of blocks read from the input like `scanf("%d")`
+/// would, and only prompts when the input is a terminal.
+///
+/// The output has to stay byte-identical to lib/builtin.c compiled by gcc,
+/// i.e. `printf("%d", x)` with no separators.
+class BuiltinIO {
+  static const size_t BUFFER_SIZE = 1 << 16;
+
+  int mInFd;
+  int mOutFd;
+  bool mInteractive;
+
+  char mOut[BUFFER_SIZE];
+  size_t mOutLen;
+
+  char mIn[BUFFER_SIZE];
+  size_t mInPos;
+  size_t mInLen;
+  bool mInEof;
+
+  void writeAll(const char *data, size_t len) {
+    while (len > 0) {
+      ssize_t n = ::write(mOutFd, data, len);
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        return;
+      }
+      data += n;
+      len -= n;
+    }
+  }
+
+  /// next input character, -1 at the end of the input
+  int peekChar() {
+    if (mInPos == mInLen) {
+      if (mInEof)
+        return -1;
+      ssize_t n;
+      do {
+        n = ::read(mInFd, mIn, BUFFER_SIZE);
+      } while (n < 0 && errno == EINTR);
+      if (n <= 0) {
+        mInEof = true;
+        return -1;
+      }
+      mInPos = 0;
+      mInLen = n;
+    }
+    return (unsigned char)mIn[mInPos];
+  }
+
+public:
+  explicit BuiltinIO(int inFd = 0, int outFd = 2)
+      : mInFd(inFd), mOutFd(outFd), mInteractive(isatty(inFd)), mOutLen(0),
+        mInPos(0), mInLen(0), mInEof(false) {}
+  ~BuiltinIO() { flush(); }
+  BuiltinIO(const BuiltinIO &) = delete;
+  BuiltinIO &operator=(const BuiltinIO &) = delete;
+
+  void flush() {
+    writeAll(mOut, mOutLen);
+    mOutLen = 0;
+  }
+
+  void print(int val) {
+    if (mOutLen + 16 > BUFFER_SIZE)
+      flush();
+    char digits[16];
+    int n = 0;
+    /// negate as unsigned so INT_MIN works
+    unsigned uval = val < 0 ? 0u - (unsigned)val : (unsigned)val;
+    do {
+      digits[n++] = '0' + uval % 10;
+      uval /= 10;
+    } while (uval);
+    if (val < 0)
+      mOut[mOutLen++] = '-';
+    while (n > 0)
+      mOut[mOutLen++] = digits[--n];
+  }
+
+  /// `scanf("%d")`: skip white space, optional sign, digits. Returns 0 if
+  /// there is no number.
+  int get() {
+    if (mInteractive) {
+      /// let the user see everything printed so far
+      flush();
+      llvm::outs() << "Please Input an Integer Value : ";
+      llvm::outs().flush();
+    }
+    int c;
+    while ((c = peekChar()) == ' ' || (c >= '\t' && c <= '\r'))
+      mInPos++;
+    bool negative = false;
+    if (c == '-' || c == '+') {
+      negative = c == '-';
+      mInPos++;
+      c = peekChar();
+    }
+    unsigned val = 0;
+    while (c >= '0' && c <= '9') {
+      val = val * 10 + (c - '0');
+      mInPos++;
+      c = peekChar();
+    }
+    return negative ? (int)(0u - val) : (int)val;
+  }
+};
+
+#endif
@@ -0,0 +1,202 @@
+//==--- Builtins.h - Registry of the functions without an interpreted body -==//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_BUILTINS_H
+#define AST_INTERPRETER_BUILTINS_H
+
+#include <cstdint>
+#include <exception>
+#include <string>
+#include <vector>
+
+#include <dlfcn.h>
+
+#include "clang/AST/Decl.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "Resolver.h"
+#include "Trace.h"
+
+using namespace clang;
+
+/// How a call to a function is carried out.
+enum BuiltinKind {
+  /// interpret the body of the function
+  BK_None,
+  BK_Get,
+  BK_Print,
+  BK_Malloc,
+  BK_Free,
+  /// call a function of a library loaded with `--native`
+  BK_Native
+};
+
+/// What a callee was resolved to, see BuiltinRegistry::resolve.
+struct CallTarget {
+  BuiltinKind mKind;
+  /// the body to interpret for BK_None, null if there is none
+  FunctionDecl *mDefinition;
+  /// index of the native function for BK_Native
+  unsigned mNative;
+};
+
+/// A function of a shared library that is called instead of interpreted.
+/// It is called with every argument widened to a machine word, so all its
+/// parameters must be passed in registers: at most MAX_NATIVE_PARAMS ints or
+/// pointers. Pointers are translated to host addresses of Memory.
+struct NativeFunction {
+  std::string mName;
+  void *mAddr;
+  unsigned mNumParams;
+  /// bit i is set if parameter i is a pointer; such an argument is passed
+  /// as the host address of that Memory offset, except that 0 (NULL) stays
+  /// a null pointer
+  unsigned mPointerParams;
+  /// bytes of the return value, 0 for void; only they are defined in the
+  /// return register
+  int mReturnSize;
+  bool mReturnsSigned;
+};
+
+/// BuiltinRegistry resolves every function of the program once, before it
+/// runs, to one of the interpreter's builtins (GET, PRINT, MALLOC, FREE), its
+/// interpreted body, or a native function of a library loaded with
+/// `--native=<lib.so>` (for declarations without a body). The evaluators then
+/// dispatch a call with one lookup instead of comparing the callee against
+/// every builtin.
+class BuiltinRegistry {
+public:
+  static const unsigned MAX_NATIVE_PARAMS = 6;
+
+private:
+  llvm::StringMap<BuiltinKind> mBuiltins;
+  std::vector<void *> mLibraries;
+  std::vector<NativeFunction> mNatives;
+  /// every redeclaration of every function of the program
+  llvm::DenseMap<const FunctionDecl *, CallTarget> mTargets;
+
+  /// the symbol \p name of the loaded libraries, null if there is none
+  void *findSymbol(const std::string &name) const {
+    for (void *library : mLibraries)
+      if (void *addr = dlsym(library, name.c_str()))
+        return addr;
+    return nullptr;
+  }
+
+  /// register \p fdecl as a native function if a library defines it
+  bool resolveNative(const FunctionDecl *fdecl, CallTarget &target) {
+    std::string name = fdecl->getNameAsString();
+    void *addr = findSymbol(name);
+    if (!addr)
+      return false;
+    QualType returnType = fdecl->getReturnType();
+    NativeFunction native{name, addr, fdecl->getNumParams(), 0, 0, false};
+    /// the arguments of a call are passed as the fixed parameters, which a
+    /// variadic callee would not expect
+    bool supported = !fdecl->isVariadic() &&
+                     native.mNumParams <= MAX_NATIVE_PARAMS &&
+                     (returnType->isVoidType() || returnType->isIntegerType());
+    if (supported && !returnType->isVoidType()) {
+      native.mReturnSize = typeSize(returnType);
+      native.mReturnsSigned = returnType->isSignedIntegerType();
+    }
+    for (unsigned i = 0; supported && i < native.mNumParams; i++) {
+      QualType type = fdecl->getParamDecl(i)->getType();
+      if (type->isPointerType())
+        native.mPointerParams |= 1u << i;
+      else if (!type->isIntegerType())
+        supported = false;
+    }
+    if (!supported) {
+      llvm::errs() << "warning: native " << name << " needs at most "
+                   << MAX_NATIVE_PARAMS
+                   << " int or pointer parameters, no `...`, and must return "
+                      "int or void, it is not used\n";
+      return false;
+    }
+    ASTI_TRACE(TL_Info, "native function " << name << "\n");
+    target.mKind = BK_Native;
+    target.mNative = mNatives.size();
+    mNatives.push_back(native);
+    return true;
+  }
+
+public:
+  BuiltinRegistry() {
+    mBuiltins["GET"] = BK_Get;
+    mBuiltins["PRINT"] = BK_Print;
+    mBuiltins["MALLOC"] = BK_Malloc;
+    mBuiltins["FREE"] = BK_Free;
+  }
+  ~BuiltinRegistry() {
+    for (void *library : mLibraries)
+      dlclose(library);
+  }
+  BuiltinRegistry(const BuiltinRegistry &) = delete;
+  BuiltinRegistry &operator=(const BuiltinRegistry &) = delete;
+
+  /// make the functions of the shared library \p path available to the
+  /// declarations without a body
+  bool loadLibrary(const std::string &path) {
+    void *library = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!library) {
+      llvm::errs() << "cannot load " << path << ": " << dlerror() << "\n";
+      return false;
+    }
+    mLibraries.push_back(library);
+    return true;
+  }
+
+  /// Resolve every function of \p unit. The builtins win over a body with
+  /// the same name, a body wins over a native function.
+  void resolve(TranslationUnitDecl *unit) {
+    for (Decl *decl : unit->decls()) {
+      FunctionDecl *fdecl = dyn_cast<FunctionDecl>(decl);
+      if (!fdecl || mTargets.count(fdecl))
+        continue;
+      CallTarget target{BK_None, fdecl->getDefinition(), 0};
+      auto builtin = mBuiltins.find(fdecl->getName());
+      if (builtin != mBuiltins.end())
+        target.mKind = builtin->second;
+      else if (!target.mDefinition)
+        resolveNative(fdecl, target);
+      for (const FunctionDecl *redecl : fdecl->redecls())
+        mTargets[redecl] = target;
+    }
+  }
+
+  /// what a call to \p callee does
+  const CallTarget &lookup(const FunctionDecl *callee) const {
+    auto it = mTargets.find(callee);
+    assert(it != mTargets.end() && "function was not resolved");
+    return it->second;
+  }
+
+  const NativeFunction &getNative(unsigned idx) const { return mNatives[idx]; }
+
+  /// Call native function \p idx with the ints at \p args, pointers being
+  /// offsets into \p memory or 0 for NULL.
+  int callNative(unsigned idx, const int *args, char *memory) const {
+    const NativeFunction &native = mNatives[idx];
+    intptr_t words[MAX_NATIVE_PARAMS] = {};
+    for (unsigned i = 0; i < native.mNumParams; i++)
+      words[i] = native.mPointerParams >> i & 1 && args[i]
+                     ? (intptr_t)(memory + args[i])
+                     : (intptr_t)args[i];
+    typedef intptr_t (*Word6)(intptr_t, intptr_t, intptr_t, intptr_t,
+                              intptr_t, intptr_t);
+    intptr_t ret = ((Word6)native.mAddr)(words[0], words[1], words[2],
+                                         words[3], words[4], words[5]);
+    switch (native.mReturnSize) {
+    case 0: return 0;
+    case 1: return native.mReturnsSigned ? (int)(signed char)ret
+                                         : (int)(unsigned char)ret;
+    case 2: return native.mReturnsSigned ? (int)(short)ret
+                                         : (int)(unsigned short)ret;
+    default: return (int)ret;
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,738 @@
+//==--- Bytecode.h - Register bytecode and its compiler ---------------------==//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_BYTECODE_H
+#define AST_INTERPRETER_BYTECODE_H
+
+#include <memory>
+#include <vector>
+
+#include "Environment.h"
+
+/// Opcodes of the register bytecode. Operands are register numbers unless
+/// noted otherwise. Registers [0, numSlots) of a frame are the variable slots
+/// assigned by the Resolver, the rest are temporaries of the compiler.
+#define BYTECODE_OPCODES(X)                                                    \
+  X(LoadImm)     /* A = imm B */                                               \
+  X(Move)        /* A = B */                                                   \
+  X(LoadGlobal)  /* A = global slot B */                                       \
+  X(StoreGlobal) /* global slot A = B */                                       \
+  X(Add)         /* A = B + C */                                               \
+  X(Sub)                                                                       \
+  X(Mul)                                                                       \
+  X(Div)                                                                       \
+  X(Rem)                                                                       \
+  X(Lt)                                                                        \
+  X(Gt)                                                                        \
+  X(Le)                                                                        \
+  X(Ge)                                                                        \
+  X(Eq)                                                                        \
+  X(Ne)                                                                        \
+  X(AddImm)      /* A = B + imm C */                                           \
+  X(MulImm)      /* A = B * imm C */                                           \
+  X(DivImm)      /* A = B / imm C */                                           \
+  X(Neg)         /* A = -B */                                                  \
+  X(Not)         /* A = ~B */                                                  \
+  X(LNot)        /* A = !B */                                                  \
+  X(FrameAddr)   /* A = memory of the frame + imm B */                        \
+  X(Load)        /* A = int at address B */                                    \
+  X(Store)       /* int at address A = B */                                    \
+  X(LoadN)       /* A = imm |C| bytes at B, sign extended if C < 0 */          \
+  X(StoreN)      /* imm C bytes at A = B */                                    \
+  X(ArrLoad)     /* A = ((int *)B)[C] */                                       \
+  X(ArrStore)    /* ((int *)A)[B] = C */                                       \
+  X(Jump)        /* goto A */                                                  \
+  X(JumpIf)      /* if (A) goto B */                                           \
+  X(JumpIfNot)   /* if (!A) goto B */                                          \
+  X(JumpLt)      /* if (A < B) goto C */                                       \
+  X(JumpGt)                                                                    \
+  X(JumpLe)                                                                    \
+  X(JumpGe)                                                                    \
+  X(JumpEq)                                                                    \
+  X(JumpNe)                                                                    \
+  X(Idiom)       /* run loop idiom A and goto B, or enter the loop */          \
+  X(Call)        /* A = function B (args from register C on) */                \
+  X(TailCall)    /* return function B (args from register C on) */             \
+  X(Ret)         /* return A */                                                \
+  X(Get)         /* A = GET() */                                               \
+  X(Print)       /* PRINT(A) */                                                \
+  X(Malloc)      /* A = MALLOC(B) */                                           \
+  X(Free)        /* FREE(A) */                                                 \
+  X(Native)      /* A = native function B (args from register C on) */
+
+enum Opcode {
+#define BYTECODE_ENUM(op) OP_##op,
+  BYTECODE_OPCODES(BYTECODE_ENUM)
+#undef BYTECODE_ENUM
+};
+
+struct Instr {
+  int mOp;
+  int mA, mB, mC;
+};
+
+/// A function lowered to bytecode. It is compiled the first time it is called.
+struct BCFunction {
+  FunctionDecl *mDecl;
+  std::vector<Instr> mCode;
+  unsigned mNumParams;
+  /// registers of one frame: the variable slots followed by temporaries
+  unsigned mNumRegs;
+  /// bytes of Memory for the variables that need an address
+  unsigned mMemSize;
+  /// the instruction that evaluates the condition of each loop, where a
+  /// loop the walker is running can continue as bytecode (see Tiering)
+  llvm::DenseMap<const Stmt *, unsigned> mLoopHeads;
+  bool mCompiled;
+
+  explicit BCFunction(FunctionDecl *fdecl)
+      : mDecl(fdecl), mCode(), mNumParams(fdecl->getNumParams()),
+        mNumRegs(0), mMemSize(0), mLoopHeads(), mCompiled(false) {}
+};
+
+/// All functions known to the bytecode engine. Calls refer to their callee by
+/// index into this table.
+class BytecodeModule {
+  std::vector<std::unique_ptr<BCFunction>> mFunctions;
+  llvm::DenseMap<const FunctionDecl *, unsigned> mIndex;
+
+public:
+  /// \p fdecl may be any redeclaration with a body somewhere
+  unsigned indexOf(FunctionDecl *fdecl) {
+    fdecl = fdecl->getDefinition();
+    assert(fdecl && "call to a function without body");
+    auto it = mIndex.find(fdecl);
+    if (it != mIndex.end())
+      return it->second;
+    mFunctions.emplace_back(new BCFunction(fdecl));
+    mIndex[fdecl] = mFunctions.size() - 1;
+    return mFunctions.size() - 1;
+  }
+
+  BCFunction &get(unsigned idx) { return *mFunctions[idx]; }
+};
+
+/// Lowers one FunctionDecl body to bytecode.
+class BytecodeCompiler {
+  Environment &mEnv;
+  BytecodeModule &mModule;
+  BCFunction &mFn;
+  /// first free temporary register
+  unsigned mNextTemp;
+  /// print what is not supported before failing
+  bool mReport;
+
+  /// pending `break`/`continue` jumps of the loops being compiled
+  struct LoopJumps {
+    std::vector<int> mBreaks;
+    std::vector<int> mContinues;
+  };
+  std::vector<LoopJumps> mLoops;
+
+  unsigned newTemp() {
+    unsigned reg = mNextTemp++;
+    if (mNextTemp > mFn.mNumRegs)
+      mFn.mNumRegs = mNextTemp;
+    return reg;
+  }
+
+  int emit(Opcode op, int a = 0, int b = 0, int c = 0) {
+    mFn.mCode.push_back(Instr{op, a, b, c});
+    return mFn.mCode.size() - 1;
+  }
+
+  int here() const { return mFn.mCode.size(); }
+
+  /// set the jump target of the branch at \p at
+  void patch(int at, int target) {
+    Instr &instr = mFn.mCode[at];
+    if (instr.mOp == OP_Jump)
+      instr.mA = target;
+    else if (instr.mOp == OP_JumpIf || instr.mOp == OP_JumpIfNot ||
+             instr.mOp == OP_Idiom)
+      instr.mB = target;
+    else
+      instr.mC = target;
+  }
+  void patchAll(const std::vector<int> &branches, int target) {
+    for (int at : branches)
+      patch(at, target);
+  }
+
+  /// the register the result of an expression goes to: \p dst if the caller
+  /// asked for one, a fresh temporary otherwise
+  unsigned target(int dst) { return dst >= 0 ? dst : newTemp(); }
+
+  /// make sure a value computed in \p reg ends up in \p dst (if given)
+  unsigned into(unsigned reg, int dst) {
+    if (dst < 0 || (unsigned)dst == reg)
+      return reg;
+    emit(OP_Move, dst, reg);
+    return dst;
+  }
+
+  [[noreturn]] void unsupported(const char *what, const Stmt *stmt) {
+    if (mReport) {
+      llvm::outs() << "Below " << what
+                   << " is not supported by the bytecode compiler:\n";
+      stmt->dump();
+    }
+    throw std::exception();
+  }
+  [[noreturn]] void unsupported(const char *what, const Decl *decl) {
+    if (mReport) {
+      llvm::outs() << "Below " << what
+                   << " is not supported by the bytecode compiler:\n";
+      decl->dump();
+    }
+    throw std::exception();
+  }
+
+public:
+  BytecodeCompiler(Environment &env, BytecodeModule &module, BCFunction &fn,
+                   bool report = true)
+      : mEnv(env), mModule(module), mFn(fn), mNextTemp(0), mReport(report) {}
+
+  void compile() {
+    /// left over by a compilation that failed
+    mFn.mCode.clear();
+    mFn.mLoopHeads.clear();
+    const FrameLayout &layout = mEnv.getResolver().getLayout(mFn.mDecl);
+    mNextTemp = mFn.mNumRegs = layout.mNumSlots;
+    mFn.mMemSize = layout.mMemSize;
+    if (layout.mSpillParams)
+      compileSpillParams();
+    compileStmt(mFn.mDecl->getBody());
+    /// falling off the end returns 0
+    unsigned zero = newTemp();
+    emit(OP_LoadImm, zero, 0);
+    emit(OP_Ret, zero);
+    mFn.mCompiled = true;
+  }
+
+  /// arguments arrive in the parameter slots, copy the ones that live in
+  /// Memory there
+  void compileSpillParams() {
+    unsigned savedTemp = mNextTemp;
+    for (unsigned i = 0; i < mFn.mNumParams; i++) {
+      ParmVarDecl *param = mFn.mDecl->getParamDecl(i);
+      VarSlot slot = mEnv.getResolver().getSlot(param);
+      if (slot.mInMemory)
+        emitStore(varAddr(slot), i, param->getType());
+    }
+    mNextTemp = savedTemp;
+  }
+
+  /// the address of a variable that lives in Memory
+  unsigned varAddr(VarSlot slot, int dst = -1) {
+    unsigned reg = target(dst);
+    if (slot.mGlobal)
+      emit(OP_LoadImm, reg,
+           mEnv.globalScope().getMemBase() + (int)slot.mOffset);
+    else
+      emit(OP_FrameAddr, reg, slot.mOffset);
+    return reg;
+  }
+
+  /// load a value of \p type from the address in \p addr, see
+  /// Environment::load
+  unsigned emitLoad(unsigned addr, QualType type, int dst) {
+    if (type->isArrayType())
+      return into(addr, dst);
+    unsigned reg = target(dst);
+    int size = typeSize(type);
+    if (size == sizeof(int))
+      emit(OP_Load, reg, addr);
+    else
+      emit(OP_LoadN, reg, addr, type->isSignedIntegerType() ? -size : size);
+    return reg;
+  }
+  void emitStore(unsigned addr, unsigned val, QualType type) {
+    int size = typeSize(type);
+    if (size == sizeof(int))
+      emit(OP_Store, addr, val);
+    else
+      emit(OP_StoreN, addr, val, size);
+  }
+
+  /// the address of the lvalue \p expr
+  unsigned compileAddr(Expr *expr, int dst) {
+    expr = expr->IgnoreParens();
+    if (DeclRefExpr *declref = dyn_cast<DeclRefExpr>(expr)) {
+      VarSlot slot = mEnv.getResolver().getSlot(declref->getDecl());
+      assert(slot.mInMemory);
+      return varAddr(slot, dst);
+    }
+    if (ArraySubscriptExpr *arrsub = dyn_cast<ArraySubscriptExpr>(expr)) {
+      unsigned base = compileExpr(arrsub->getBase());
+      unsigned idx = compileExpr(arrsub->getIdx());
+      unsigned offset = newTemp();
+      emit(OP_MulImm, offset, idx, typeSize(arrsub->getType()));
+      unsigned reg = target(dst);
+      emit(OP_Add, reg, base, offset);
+      return reg;
+    }
+    UnaryOperator *uop = dyn_cast<UnaryOperator>(expr);
+    if (uop && uop->getOpcode() == UO_Deref)
+      return compileExpr(uop->getSubExpr(), dst);
+    unsupported("lvalue", expr);
+  }
+
+  /// int and pointer elements use ArrLoad/ArrStore directly
+  static bool isWordElement(ArraySubscriptExpr *arrsub) {
+    QualType type = arrsub->getType();
+    return !type->isArrayType() && typeSize(type) == sizeof(int);
+  }
+
+  void compileStmt(Stmt *stmt) {
+    /// temporaries never live across statements
+    unsigned savedTemp = mNextTemp;
+    if (CompoundStmt *body = dyn_cast<CompoundStmt>(stmt)) {
+      for (Stmt *child : body->body())
+        compileStmt(child);
+    } else if (DeclStmt *declstmt = dyn_cast<DeclStmt>(stmt)) {
+      for (Decl *decl : declstmt->decls())
+        if (VarDecl *vardecl = dyn_cast<VarDecl>(decl))
+          compileVarDecl(vardecl);
+    } else if (ReturnStmt *retstmt = dyn_cast<ReturnStmt>(stmt)) {
+      if (mEnv.getResolver().isTailCall(retstmt)) {
+        CallExpr *call = Resolver::callOf(retstmt);
+        emit(OP_TailCall, 0, mModule.indexOf(call->getDirectCallee()),
+             compileArgs(call));
+      } else {
+        unsigned reg;
+        if (Expr *value = retstmt->getRetValue()) {
+          reg = compileExpr(value);
+        } else {
+          reg = newTemp();
+          emit(OP_LoadImm, reg, 0);
+        }
+        emit(OP_Ret, reg);
+      }
+    } else if (IfStmt *ifstmt = dyn_cast<IfStmt>(stmt)) {
+      if (const int *cond = constant(ifstmt->getCond())) {
+        /// only the branch that is taken is compiled
+        if (Stmt *taken = *cond ? ifstmt->getThen() : ifstmt->getElse())
+          compileStmt(taken);
+        mNextTemp = savedTemp;
+        return;
+      }
+      std::vector<int> toElse;
+      compileBranch(ifstmt->getCond(), false, toElse);
+      if (ifstmt->getThen())
+        compileStmt(ifstmt->getThen());
+      if (ifstmt->getElse()) {
+        int toEnd = emit(OP_Jump);
+        patchAll(toElse, here());
+        compileStmt(ifstmt->getElse());
+        patch(toEnd, here());
+      } else {
+        patchAll(toElse, here());
+      }
+    } else if (WhileStmt *wstmt = dyn_cast<WhileStmt>(stmt)) {
+      const int *cond = constant(wstmt->getCond());
+      if (cond && !*cond) {
+        mNextTemp = savedTemp;
+        return;
+      }
+      /// the condition is placed after the body, so one iteration costs a
+      /// single (conditional) branch
+      int toCond = emit(OP_Jump);
+      int body = here();
+      mLoops.push_back(LoopJumps());
+      compileStmt(wstmt->getBody());
+      mFn.mLoopHeads[wstmt] = here();
+      patch(toCond, here());
+      patchAll(mLoops.back().mContinues, here());
+      std::vector<int> toBody;
+      compileBranch(wstmt->getCond(), true, toBody);
+      patchAll(toBody, body);
+      patchAll(mLoops.back().mBreaks, here());
+      mLoops.pop_back();
+    } else if (ForStmt *fstmt = dyn_cast<ForStmt>(stmt)) {
+      if (fstmt->getInit())
+        compileStmt(fstmt->getInit());
+      const int *cond = fstmt->getCond() ? constant(fstmt->getCond()) : nullptr;
+      if (cond && !*cond) {
+        mNextTemp = savedTemp;
+        return;
+      }
+      int idiom = mEnv.getIdioms().lookup(fstmt);
+      int toEnd = idiom >= 0 ? emit(OP_Idiom, idiom, -1) : -1;
+      int toCond = emit(OP_Jump);
+      int body = here();
+      mLoops.push_back(LoopJumps());
+      compileStmt(fstmt->getBody());
+      patchAll(mLoops.back().mContinues, here());
+      if (fstmt->getInc())
+        compileStmt(fstmt->getInc());
+      mFn.mLoopHeads[fstmt] = here();
+      patch(toCond, here());
+      if (fstmt->getCond()) {
+        std::vector<int> toBody;
+        compileBranch(fstmt->getCond(), true, toBody);
+        patchAll(toBody, body);
+      } else {
+        emit(OP_Jump, body);
+      }
+      patchAll(mLoops.back().mBreaks, here());
+      if (toEnd >= 0)
+        patch(toEnd, here());
+      mLoops.pop_back();
+    } else if (isa<BreakStmt>(stmt)) {
+      mLoops.back().mBreaks.push_back(emit(OP_Jump));
+    } else if (isa<ContinueStmt>(stmt)) {
+      mLoops.back().mContinues.push_back(emit(OP_Jump));
+    } else if (isa<NullStmt>(stmt)) {
+      /// nothing to do
+    } else if (Expr *expr = dyn_cast<Expr>(stmt)) {
+      compileExpr(expr);
+    } else {
+      unsupported("stmt", stmt);
+    }
+    mNextTemp = savedTemp;
+  }
+
+  void compileVarDecl(VarDecl *vardecl) {
+    VarSlot slot = mEnv.getResolver().getSlot(vardecl);
+    auto type = vardecl->getType();
+    unsigned reg;
+    if (type->isArrayType()) {
+      if (!type->isConstantArrayType())
+        unsupported("array declaration", vardecl);
+      /// its zeroed storage came with the frame
+      return;
+    }
+    if (slot.mInMemory) {
+      unsigned val = newTemp();
+      if (Expr *init = vardecl->getInit())
+        compileExpr(init, val);
+      else
+        emit(OP_LoadImm, val, 0);
+      emitStore(varAddr(slot), val, type);
+      return;
+    }
+    if (Expr *init = vardecl->getInit()) {
+      reg = compileExpr(init, slot.mGlobal ? -1 : (int)slot.mIndex);
+    } else {
+      reg = slot.mGlobal ? newTemp() : slot.mIndex;
+      emit(OP_LoadImm, reg, 0);
+    }
+    if (slot.mGlobal)
+      emit(OP_StoreGlobal, slot.mIndex, reg);
+  }
+
+  /// emit branches that are taken when \p cond evaluates to \p onTrue;
+  /// their targets are patched by the caller
+  void compileBranch(Expr *cond, bool onTrue, std::vector<int> &branches) {
+    if (const int *value = constant(cond)) {
+      /// always or never taken
+      if ((*value != 0) == onTrue)
+        branches.push_back(emit(OP_Jump));
+      return;
+    }
+    cond = cond->IgnoreParenImpCasts();
+    if (BinaryOperator *bop = dyn_cast<BinaryOperator>(cond)) {
+      if (bop->isComparisonOp()) {
+        unsigned lreg = compileExpr(bop->getLHS());
+        unsigned rreg = compileExpr(bop->getRHS());
+        Opcode op = OP_JumpLt;
+        switch (bop->getOpcode()) {
+        case BO_LT: op = onTrue ? OP_JumpLt : OP_JumpGe; break;
+        case BO_GT: op = onTrue ? OP_JumpGt : OP_JumpLe; break;
+        case BO_LE: op = onTrue ? OP_JumpLe : OP_JumpGt; break;
+        case BO_GE: op = onTrue ? OP_JumpGe : OP_JumpLt; break;
+        case BO_EQ: op = onTrue ? OP_JumpEq : OP_JumpNe; break;
+        case BO_NE: op = onTrue ? OP_JumpNe : OP_JumpEq; break;
+        default: unsupported("comparison", bop);
+        }
+        branches.push_back(emit(op, lreg, rreg, -1));
+        return;
+      }
+    } else if (UnaryOperator *uop = dyn_cast<UnaryOperator>(cond)) {
+      if (uop->getOpcode() == UO_LNot) {
+        compileBranch(uop->getSubExpr(), !onTrue, branches);
+        return;
+      }
+    }
+    unsigned reg = compileExpr(cond);
+    branches.push_back(emit(onTrue ? OP_JumpIf : OP_JumpIfNot, reg, -1));
+  }
+
+  /// compile \p expr and return the register holding its value; if \p dst is
+  /// given the value is computed into that register
+  unsigned compileExpr(Expr *expr, int dst = -1) {
+    /// literals, sizeof and whole constant subtrees
+    if (const int *value = constant(expr)) {
+      unsigned reg = target(dst);
+      emit(OP_LoadImm, reg, *value);
+      return reg;
+    }
+    if (IntegerLiteral *literal = dyn_cast<IntegerLiteral>(expr)) {
+      unsigned reg = target(dst);
+      emit(OP_LoadImm, reg, literal->getValue().getSExtValue());
+      return reg;
+    }
+    if (ParenExpr *paren = dyn_cast<ParenExpr>(expr))
+      return compileExpr(paren->getSubExpr(), dst);
+    if (CastExpr *castexpr = dyn_cast<CastExpr>(expr))
+      return compileExpr(castexpr->getSubExpr(), dst);
+    if (DeclRefExpr *declref = dyn_cast<DeclRefExpr>(expr)) {
+      if (!isa<VarDecl>(declref->getDecl()))
+        unsupported("declref", declref);
+      VarSlot slot = mEnv.getResolver().getSlot(declref->getDecl());
+      if (slot.mInMemory)
+        return emitLoad(varAddr(slot), declref->getType(), dst);
+      if (!slot.mGlobal)
+        return into(slot.mIndex, dst);
+      unsigned reg = target(dst);
+      emit(OP_LoadGlobal, reg, slot.mIndex);
+      return reg;
+    }
+    if (UnaryExprOrTypeTraitExpr *uexpr =
+            dyn_cast<UnaryExprOrTypeTraitExpr>(expr)) {
+      unsigned reg = target(dst);
+      emit(OP_LoadImm, reg, sizeOfType(uexpr));
+      return reg;
+    }
+    if (ArraySubscriptExpr *arrsub = dyn_cast<ArraySubscriptExpr>(expr)) {
+      if (!isWordElement(arrsub))
+        return emitLoad(compileAddr(arrsub, -1), arrsub->getType(), dst);
+      unsigned base = compileExpr(arrsub->getBase());
+      unsigned idx = compileExpr(arrsub->getIdx());
+      unsigned reg = target(dst);
+      emit(OP_ArrLoad, reg, base, idx);
+      return reg;
+    }
+    if (UnaryOperator *uop = dyn_cast<UnaryOperator>(expr))
+      return compileUnary(uop, dst);
+    if (BinaryOperator *bop = dyn_cast<BinaryOperator>(expr))
+      return compileBinary(bop, dst);
+    if (CallExpr *call = dyn_cast<CallExpr>(expr))
+      return compileCall(call, dst);
+    unsupported("expr", expr);
+  }
+
+  /// the value of \p expr if the ConstantFolder computed it
+  const int *constant(Expr *expr) const {
+    return mEnv.getFolder().lookup(expr);
+  }
+
+  int sizeOfType(UnaryExprOrTypeTraitExpr *uexpr) {
+    return typeSize(uexpr->getTypeOfArgument());
+  }
+
+  unsigned compileUnary(UnaryOperator *uop, int dst) {
+    Opcode op;
+    switch (uop->getOpcode()) {
+    case UO_Plus:
+      return compileExpr(uop->getSubExpr(), dst);
+    case UO_Minus: op = OP_Neg; break;
+    case UO_Not: op = OP_Not; break;
+    case UO_LNot: op = OP_LNot; break;
+    case UO_Deref:
+      return emitLoad(compileExpr(uop->getSubExpr()), uop->getType(), dst);
+    case UO_AddrOf:
+      return compileAddr(uop->getSubExpr(), dst);
+    default: unsupported("uop", uop);
+    }
+    unsigned sub = compileExpr(uop->getSubExpr());
+    unsigned reg = target(dst);
+    emit(op, reg, sub);
+    return reg;
+  }
+
+  unsigned compileBinary(BinaryOperator *bop, int dst) {
+    auto opCode = bop->getOpcode();
+    if (opCode == BO_Assign)
+      return compileAssign(bop, dst);
+    if (opCode == BO_LAnd || opCode == BO_LOr) {
+      /// short-circuit into a fresh temporary, dst may be an operand
+      unsigned reg = newTemp();
+      std::vector<int> toEnd;
+      emit(OP_LoadImm, reg, opCode == BO_LOr);
+      compileBranch(bop->getLHS(), opCode == BO_LOr, toEnd);
+      compileBranch(bop->getRHS(), opCode == BO_LOr, toEnd);
+      emit(OP_LoadImm, reg, opCode != BO_LOr);
+      patchAll(toEnd, here());
+      return into(reg, dst);
+    }
+    Expr *left = bop->getLHS();
+    Expr *right = bop->getRHS();
+    if (bop->isAdditiveOp())
+      return compileAdditive(bop, dst);
+
+    Opcode op;
+    switch (opCode) {
+    case BO_Mul: op = OP_Mul; break;
+    case BO_Div: op = OP_Div; break;
+    case BO_Rem: op = OP_Rem; break;
+    case BO_LT: op = OP_Lt; break;
+    case BO_GT: op = OP_Gt; break;
+    case BO_LE: op = OP_Le; break;
+    case BO_GE: op = OP_Ge; break;
+    case BO_EQ: op = OP_Eq; break;
+    case BO_NE: op = OP_Ne; break;
+    default: unsupported("binop", bop);
+    }
+    unsigned lreg = compileExpr(left);
+    unsigned rreg = compileExpr(right);
+    unsigned reg = target(dst);
+    emit(op, reg, lreg, rreg);
+    return reg;
+  }
+
+  /// same pointer arithmetic as Environment::handleAdditive
+  unsigned compileAdditive(BinaryOperator *bop, int dst) {
+    Expr *left = bop->getLHS();
+    Expr *right = bop->getRHS();
+    bool lIsPtr = left->getType()->isPointerType();
+    bool rIsPtr = right->getType()->isPointerType();
+    bool isSub = bop->getOpcode() == BO_Sub;
+    /// the size of the pointee
+    int scale = 1;
+    if (lIsPtr)
+      scale = typeSize(left->getType()->getPointeeType());
+    else if (rIsPtr)
+      scale = typeSize(right->getType()->getPointeeType());
+
+    /// `x + 1`, `p - 2`, `i + N * 4`, ...
+    if (!rIsPtr) {
+      if (const int *value = constant(right)) {
+        int imm = *value * (lIsPtr ? scale : 1);
+        unsigned lreg = compileExpr(left);
+        unsigned reg = target(dst);
+        emit(OP_AddImm, reg, lreg, isSub ? -imm : imm);
+        return reg;
+      }
+    }
+    unsigned lreg = compileExpr(left);
+    unsigned rreg = compileExpr(right);
+    if (lIsPtr && !rIsPtr) {
+      unsigned scaled = newTemp();
+      emit(OP_MulImm, scaled, rreg, scale);
+      rreg = scaled;
+    } else if (rIsPtr && !lIsPtr) {
+      unsigned scaled = newTemp();
+      emit(OP_MulImm, scaled, lreg, scale);
+      lreg = scaled;
+    }
+    unsigned reg = target(dst);
+    emit(isSub ? OP_Sub : OP_Add, reg, lreg, rreg);
+    if (lIsPtr && rIsPtr)
+      emit(OP_DivImm, reg, reg, scale);
+    return reg;
+  }
+
+  unsigned compileAssign(BinaryOperator *bop, int dst) {
+    Expr *left = bop->getLHS()->IgnoreParens();
+    Expr *right = bop->getRHS();
+    if (DeclRefExpr *declref = dyn_cast<DeclRefExpr>(left)) {
+      VarSlot slot = mEnv.getResolver().getSlot(declref->getDecl());
+      if (slot.mInMemory) {
+        unsigned val = compileExpr(right);
+        emitStore(varAddr(slot), val, declref->getType());
+        return into(val, dst);
+      }
+      if (!slot.mGlobal)
+        return into(compileExpr(right, slot.mIndex), dst);
+      unsigned val = compileExpr(right, dst);
+      emit(OP_StoreGlobal, slot.mIndex, val);
+      return val;
+    }
+    /// the value is only moved to dst after the store, dst may be the
+    /// register of the base or index
+    if (ArraySubscriptExpr *arrsub = dyn_cast<ArraySubscriptExpr>(left)) {
+      if (!isWordElement(arrsub)) {
+        unsigned addr = compileAddr(arrsub, -1);
+        unsigned val = compileExpr(right);
+        emitStore(addr, val, arrsub->getType());
+        return into(val, dst);
+      }
+      unsigned base = compileExpr(arrsub->getBase());
+      unsigned idx = compileExpr(arrsub->getIdx());
+      unsigned val = compileExpr(right);
+      emit(OP_ArrStore, base, idx, val);
+      return into(val, dst);
+    }
+    if (UnaryOperator *uop = dyn_cast<UnaryOperator>(left)) {
+      if (uop->getOpcode() == UO_Deref) {
+        unsigned addr = compileExpr(uop->getSubExpr());
+        unsigned val = compileExpr(right);
+        emitStore(addr, val, uop->getType());
+        return into(val, dst);
+      }
+    }
+    unsupported("Assignment(LHS)", left);
+  }
+
+  unsigned compileCall(CallExpr *call, int dst) {
+    FunctionDecl *callee = call->getDirectCallee();
+    if (!callee)
+      unsupported("indirect call", call);
+    const CallTarget &callTarget = mEnv.getCallTarget(callee);
+    switch (callTarget.mKind) {
+    case BK_Get: {
+      unsigned reg = target(dst);
+      emit(OP_Get, reg);
+      return reg;
+    }
+    case BK_Print: {
+      unsigned val = compileExpr(call->getArg(0));
+      emit(OP_Print, val);
+      return val;
+    }
+    case BK_Malloc: {
+      unsigned size = compileExpr(call->getArg(0));
+      unsigned reg = target(dst);
+      emit(OP_Malloc, reg, size);
+      return reg;
+    }
+    case BK_Free: {
+      unsigned addr = compileExpr(call->getArg(0));
+      emit(OP_Free, addr);
+      return addr;
+    }
+    case BK_Native: {
+      unsigned argBase = compileArgs(call);
+      unsigned reg = target(dst);
+      emit(OP_Native, reg, callTarget.mNative, argBase);
+      return reg;
+    }
+    case BK_None:
+      if (!callTarget.mDefinition)
+        mEnv.noBody(callee);
+      break;
+    }
+    unsigned argBase = compileArgs(call);
+    unsigned reg = target(dst);
+    emit(OP_Call, reg, mModule.indexOf(callee), argBase);
+    return reg;
+  }
+
+  /// arguments go to consecutive registers, the callee copies them into
+  /// its parameter slots; returns the first one
+  unsigned compileArgs(CallExpr *call) {
+    unsigned argBase = mNextTemp;
+    for (unsigned i = 0; i < call->getNumArgs(); i++)
+      newTemp();
+    for (unsigned i = 0; i < call->getNumArgs(); i++)
+      compileExpr(call->getArg(i), argBase + i);
+    return argBase;
+  }
+};
+
+/// function \p idx of \p module, compiled to bytecode on first use; see
+/// BytecodeCompiler for \p report
+inline BCFunction &compiledFunction(Environment &env, BytecodeModule &module,
+                                    unsigned idx, bool report = true) {
+  BCFunction &fn = module.get(idx);
+  if (!fn.mCompiled) {
+    BytecodeCompiler(env, module, fn, report).compile();
+    ASTI_TRACE(TL_Info, "compiled " << fn.mDecl->getName() << ": "
+                                    << fn.mCode.size() << " instructions, "
+                                    << fn.mNumRegs << " registers\n");
+  }
+  return fn;
+}
+
+#endif
@@ -0,0 +1,230 @@
+//==--- BytecodeVM.h - Dispatch loop of the bytecode engine -----------------==//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_BYTECODEVM_H
+#define AST_INTERPRETER_BYTECODEVM_H
+
+#include <algorithm>
+
+#include "Bytecode.h"
+#include "FrameArena.h"
+#include "JIT.h"
+
+/// GCC and Clang support `goto *label`, which lets every handler jump
+/// straight to the next one instead of going back through a switch.
+#if defined(__GNUC__)
+#define BYTECODE_THREADED 1
+#else
+#define BYTECODE_THREADED 0
+#endif
+
+/// Runs the functions of a program as bytecode. Globals, Memory and the
+/// built-ins are shared with the Environment, so `Environment::init` is
+/// still what evaluates the global initializers.
+///
+/// A call does not recurse on the C++ stack: the caller's state is saved in
+/// mCalls and the loop continues in the callee, so the interpreted recursion
+/// depth is only bounded by the frame arena budget (`--stack-size`).
+class BytecodeVM {
+  Environment &mEnv;
+  BytecodeModule mModule;
+  /// register windows of the calls, shared with the tree walker's frames
+  FrameArena &mFrames;
+
+  /// where a caller continues once its callee returns
+  struct CallFrame {
+    const Instr *mCode;
+    /// the Call instruction
+    const Instr *mPC;
+    int *mRegs;
+    Memory::Addr mMem;
+  };
+  std::vector<CallFrame> mCalls;
+  /// arguments of a tail call while the frames are swapped
+  std::vector<int> mTailArgs;
+#if ASTI_JIT
+  /// native code of the functions with `--jit`, null otherwise
+  std::unique_ptr<JIT> mJIT;
+#endif
+
+  BCFunction &function(unsigned idx) {
+    return compiledFunction(mEnv, mModule, idx);
+  }
+
+public:
+  /// \p jit: run the functions as native code compiled by the JIT, if it
+  /// was built in (`--jit`)
+  explicit BytecodeVM(Environment &env, bool jit = false)
+      : mEnv(env), mModule(), mFrames(env.getFrames()), mCalls(),
+        mTailArgs() {
+#if ASTI_JIT
+    if (jit)
+      mJIT = JIT::create(env, mModule);
+#endif
+  }
+
+  /// run \p entry (e.g. `main`) and return its return value
+  int run(FunctionDecl *entry) { return call(entry, nullptr); }
+
+  /// call \p fdecl with the \p args and return its return value
+  int call(FunctionDecl *fdecl, const int *args) {
+    unsigned idx = mModule.indexOf(fdecl);
+#if ASTI_JIT
+    /// the JIT compiles everything fdecl calls along with it, the dispatch
+    /// loop only runs what it failed to compile
+    if (mJIT)
+      if (JITFunction native = mJIT->get(idx))
+        return mJIT->call(native, args);
+#endif
+    BCFunction &fn = function(idx);
+    int *r = mFrames.push(fn.mNumRegs);
+    if (args)
+      std::copy(args, args + fn.mNumParams, r);
+    return execute(fn, fn.mCode.data(), r,
+                   mEnv.getMemory().stackAlloc(fn.mMemSize));
+  }
+
+  /// On-stack replacement: continue \p fdecl, which the walker is running in
+  /// \p frame, at the condition of \p loop (see BCFunction::mLoopHeads).
+  /// The registers start with the slots of the frame and the variables in
+  /// Memory are the frame's; return what the function returns.
+  int resume(FunctionDecl *fdecl, const Stmt *loop, StackFrame &frame) {
+    BCFunction &fn = function(mModule.indexOf(fdecl));
+    auto head = fn.mLoopHeads.find(loop);
+    assert(head != fn.mLoopHeads.end() && "no bytecode for the loop");
+    int *r = mFrames.push(fn.mNumRegs);
+    std::copy(frame.slotData(), frame.slotData() + frame.getNumSlots(), r);
+    /// the frame is on top of Memory, so the Ret releasing its Memory early
+    /// is harmless: the walker releases it again when it pops the frame
+    return execute(fn, fn.mCode.data() + head->second, r, frame.getMemBase());
+  }
+
+  BytecodeModule &getModule() { return mModule; }
+
+private:
+  /// run \p fn from \p start in the registers \p r with the frame Memory at
+  /// \p mem until it returns
+  int execute(BCFunction &fn, const Instr *start, int *r, Memory::Addr mem) {
+    Memory &memory = mEnv.getMemory();
+    int *globals = mEnv.globalScope().slotData();
+
+    /// state of the running function
+    const Instr *code = fn.mCode.data();
+    const Instr *pc = start;
+    /// instructions dispatched, for `--stats`
+    unsigned long long executed = 0;
+
+#if BYTECODE_THREADED
+    static void *const labels[] = {
+#define BYTECODE_LABEL(op) &&L_##op,
+        BYTECODE_OPCODES(BYTECODE_LABEL)
+#undef BYTECODE_LABEL
+    };
+#define CASE(op) L_##op:
+#define NEXT() do { ++executed; goto *labels[pc->mOp]; } while (0)
+    NEXT();
+#else
+#define CASE(op) case OP_##op:
+#define NEXT() continue
+    for (;; ++executed) {
+      switch (pc->mOp) {
+#endif
+
+    CASE(LoadImm) r[pc->mA] = pc->mB; ++pc; NEXT();
+    CASE(Move) r[pc->mA] = r[pc->mB]; ++pc; NEXT();
+    CASE(LoadGlobal) r[pc->mA] = globals[pc->mB]; ++pc; NEXT();
+    CASE(StoreGlobal) globals[pc->mA] = r[pc->mB]; ++pc; NEXT();
+    CASE(Add) r[pc->mA] = r[pc->mB] + r[pc->mC]; ++pc; NEXT();
+    CASE(Sub) r[pc->mA] = r[pc->mB] - r[pc->mC]; ++pc; NEXT();
+    CASE(Mul) r[pc->mA] = r[pc->mB] * r[pc->mC]; ++pc; NEXT();
+    CASE(Div) r[pc->mA] = r[pc->mB] / r[pc->mC]; ++pc; NEXT();
+    CASE(Rem) r[pc->mA] = r[pc->mB] % r[pc->mC]; ++pc; NEXT();
+    CASE(Lt) r[pc->mA] = r[pc->mB] < r[pc->mC]; ++pc; NEXT();
+    CASE(Gt) r[pc->mA] = r[pc->mB] > r[pc->mC]; ++pc; NEXT();
+    CASE(Le) r[pc->mA] = r[pc->mB] <= r[pc->mC]; ++pc; NEXT();
+    CASE(Ge) r[pc->mA] = r[pc->mB] >= r[pc->mC]; ++pc; NEXT();
+    CASE(Eq) r[pc->mA] = r[pc->mB] == r[pc->mC]; ++pc; NEXT();
+    CASE(Ne) r[pc->mA] = r[pc->mB] != r[pc->mC]; ++pc; NEXT();
+    CASE(AddImm) r[pc->mA] = r[pc->mB] + pc->mC; ++pc; NEXT();
+    CASE(MulImm) r[pc->mA] = r[pc->mB] * pc->mC; ++pc; NEXT();
+    CASE(DivImm) r[pc->mA] = r[pc->mB] / pc->mC; ++pc; NEXT();
+    CASE(Neg) r[pc->mA] = -r[pc->mB]; ++pc; NEXT();
+    CASE(Not) r[pc->mA] = ~r[pc->mB]; ++pc; NEXT();
+    CASE(LNot) r[pc->mA] = !r[pc->mB]; ++pc; NEXT();
+    CASE(FrameAddr) r[pc->mA] = mem + pc->mB; ++pc; NEXT();
+    CASE(Load) r[pc->mA] = memory.loadInt(r[pc->mB]); ++pc; NEXT();
+    CASE(Store) memory.storeInt(r[pc->mA], r[pc->mB]); ++pc; NEXT();
+    CASE(LoadN) r[pc->mA] = memory.load(r[pc->mB], pc->mC < 0 ? -pc->mC : pc->mC, pc->mC < 0); ++pc; NEXT();
+    CASE(StoreN) memory.store(r[pc->mA], r[pc->mB], pc->mC); ++pc; NEXT();
+    CASE(ArrLoad) r[pc->mA] = memory.loadInt(r[pc->mB] + r[pc->mC] * (int)sizeof(int)); ++pc; NEXT();
+    CASE(ArrStore) memory.storeInt(r[pc->mA] + r[pc->mB] * (int)sizeof(int), r[pc->mC]); ++pc; NEXT();
+    CASE(Jump) pc = code + pc->mA; NEXT();
+    CASE(Idiom)
+      pc = mEnv.runIdiom(pc->mA, r, mem) ? code + pc->mB : pc + 1;
+      NEXT();
+    CASE(JumpIf) pc = r[pc->mA] ? code + pc->mB : pc + 1; NEXT();
+    CASE(JumpIfNot) pc = !r[pc->mA] ? code + pc->mB : pc + 1; NEXT();
+    CASE(JumpLt) pc = r[pc->mA] < r[pc->mB] ? code + pc->mC : pc + 1; NEXT();
+    CASE(JumpGt) pc = r[pc->mA] > r[pc->mB] ? code + pc->mC : pc + 1; NEXT();
+    CASE(JumpLe) pc = r[pc->mA] <= r[pc->mB] ? code + pc->mC : pc + 1; NEXT();
+    CASE(JumpGe) pc = r[pc->mA] >= r[pc->mB] ? code + pc->mC : pc + 1; NEXT();
+    CASE(JumpEq) pc = r[pc->mA] == r[pc->mB] ? code + pc->mC : pc + 1; NEXT();
+    CASE(JumpNe) pc = r[pc->mA] != r[pc->mB] ? code + pc->mC : pc + 1; NEXT();
+    CASE(Call) {
+      BCFunction &callee = function(pc->mB);
+      int *calleeRegs = mFrames.push(callee.mNumRegs);
+      std::copy(r + pc->mC, r + pc->mC + callee.mNumParams, calleeRegs);
+      mCalls.push_back(CallFrame{code, pc, r, mem});
+      mem = memory.stackAlloc(callee.mMemSize);
+      r = calleeRegs;
+      code = pc = callee.mCode.data();
+      NEXT();
+    }
+    CASE(TailCall) {
+      /// the callee takes over the frame, it returns to our caller
+      BCFunction &callee = function(pc->mB);
+      mTailArgs.assign(r + pc->mC, r + pc->mC + callee.mNumParams);
+      memory.stackRelease(mem);
+      mFrames.pop(r);
+      r = mFrames.push(callee.mNumRegs);
+      std::copy(mTailArgs.begin(), mTailArgs.end(), r);
+      mem = memory.stackAlloc(callee.mMemSize);
+      code = pc = callee.mCode.data();
+      NEXT();
+    }
+    CASE(Ret) {
+      int ret = r[pc->mA];
+      memory.stackRelease(mem);
+      mFrames.pop(r);
+      if (mCalls.empty()) {
+        mEnv.addNodes(executed);
+        return ret;
+      }
+      const CallFrame &caller = mCalls.back();
+      code = caller.mCode;
+      pc = caller.mPC;
+      r = caller.mRegs;
+      mem = caller.mMem;
+      mCalls.pop_back();
+      r[pc->mA] = ret;
+      ++pc;
+      NEXT();
+    }
+    CASE(Get) r[pc->mA] = mEnv.builtinGet(); ++pc; NEXT();
+    CASE(Print) mEnv.builtinPrint(r[pc->mA]); ++pc; NEXT();
+    CASE(Malloc) r[pc->mA] = mEnv.builtinMalloc(r[pc->mB]); ++pc; NEXT();
+    CASE(Free) mEnv.builtinFree(r[pc->mA]); ++pc; NEXT();
+    CASE(Native)
+      r[pc->mA] = mEnv.callNative(pc->mB, &r[pc->mC]);
+      ++pc;
+      NEXT();
+
+#if !BYTECODE_THREADED
+      }
+    }
+#endif
+#undef CASE
+#undef NEXT
+  }
+};
+
+#endif
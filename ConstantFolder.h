@@ -0,0 +1,160 @@
+//==--- ConstantFolder.h - Values of the constant subexpressions -----------==//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_CONSTANTFOLDER_H
+#define AST_INTERPRETER_CONSTANTFOLDER_H
+
+#include <climits>
+
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+#include "llvm/ADT/DenseMap.h"
+
+#include "Resolver.h"
+
+using namespace clang;
+
+/// Bytes of \p type if typeSize() knows them, so sizeof can be folded
+/// without typeSize() reporting the unknown ones.
+inline bool hasTypeSize(QualType type) {
+  if (type->isPointerType())
+    return true;
+  if (const ConstantArrayType *arrayType =
+          dyn_cast_or_null<ConstantArrayType>(type->getAsArrayTypeUnsafe()))
+    return hasTypeSize(arrayType->getElementType());
+  return type->isIntegerType();
+}
+
+/// ConstantFolder walks the program once before execution and computes the
+/// value of every expression built only from literals and `sizeof`, with the
+/// same int arithmetic the evaluators use. Only the largest constant subtrees
+/// are kept: the evaluators look an expression up before walking it and use
+/// the value instead, so a constant subtree costs one lookup, however often
+/// it runs. The constant conditions of `if` and loops are kept too, which
+/// lets the evaluators drop the dead branch.
+///
+/// Operations that would trap or that the evaluators do not support (division
+/// by zero, assignments, ...) are never folded and still fail at run time.
+class ConstantFolder {
+  /// values of the largest constant subtrees
+  llvm::DenseMap<const Stmt *, int> mConstants;
+  /// values of every constant node while folding
+  llvm::DenseMap<const Stmt *, int> mValues;
+
+  bool valueOf(const Expr *expr, int &value) const {
+    auto it = mValues.find(expr);
+    if (it == mValues.end())
+      return false;
+    value = it->second;
+    return true;
+  }
+
+  /// the value of \p expr if it is constant; its children are folded already
+  bool evaluate(Expr *expr, int &value) const {
+    if (IntegerLiteral *literal = dyn_cast<IntegerLiteral>(expr)) {
+      value = literal->getValue().getSExtValue();
+      return true;
+    }
+    if (UnaryExprOrTypeTraitExpr *uexpr =
+            dyn_cast<UnaryExprOrTypeTraitExpr>(expr)) {
+      if (uexpr->getKind() != UETT_SizeOf ||
+          !hasTypeSize(uexpr->getTypeOfArgument()))
+        return false;
+      value = typeSize(uexpr->getTypeOfArgument());
+      return true;
+    }
+    /// casts keep the value, like stealBindingFromChild
+    if (ParenExpr *paren = dyn_cast<ParenExpr>(expr))
+      return valueOf(paren->getSubExpr(), value);
+    if (CastExpr *castexpr = dyn_cast<CastExpr>(expr))
+      return valueOf(castexpr->getSubExpr(), value);
+    if (UnaryOperator *uop = dyn_cast<UnaryOperator>(expr)) {
+      int sub;
+      if (!valueOf(uop->getSubExpr(), sub))
+        return false;
+      switch (uop->getOpcode()) {
+      case UO_Plus: value = sub; return true;
+      case UO_Minus: value = (int)(0u - (unsigned)sub); return true;
+      case UO_Not: value = ~sub; return true;
+      case UO_LNot: value = !sub; return true;
+      default: return false;
+      }
+    }
+    if (BinaryOperator *bop = dyn_cast<BinaryOperator>(expr)) {
+      /// pointer arithmetic scales, leave it to the evaluators
+      if (bop->getLHS()->getType()->isPointerType() ||
+          bop->getRHS()->getType()->isPointerType())
+        return false;
+      int lval, rval;
+      if (!valueOf(bop->getLHS(), lval) || !valueOf(bop->getRHS(), rval))
+        return false;
+      /// + - * wrap around like the machine ints of the evaluators
+      switch (bop->getOpcode()) {
+      case BO_Add: value = (int)((unsigned)lval + (unsigned)rval); return true;
+      case BO_Sub: value = (int)((unsigned)lval - (unsigned)rval); return true;
+      case BO_Mul: value = (int)((unsigned)lval * (unsigned)rval); return true;
+      case BO_Div:
+      case BO_Rem:
+        if (rval == 0 || (lval == INT_MIN && rval == -1))
+          return false;
+        value = bop->getOpcode() == BO_Div ? lval / rval : lval % rval;
+        return true;
+      case BO_LT: value = lval < rval; return true;
+      case BO_GT: value = lval > rval; return true;
+      case BO_LE: value = lval <= rval; return true;
+      case BO_GE: value = lval >= rval; return true;
+      case BO_EQ: value = lval == rval; return true;
+      case BO_NE: value = lval != rval; return true;
+      case BO_LAnd: value = lval && rval; return true;
+      case BO_LOr: value = lval || rval; return true;
+      default: return false;
+      }
+    }
+    return false;
+  }
+
+  /// fold the subtrees of \p stmt; true if \p stmt itself is constant
+  bool fold(Stmt *stmt) {
+    bool constantChild = false;
+    for (Stmt *child : stmt->children())
+      if (child && fold(child))
+        constantChild = true;
+    Expr *expr = dyn_cast<Expr>(stmt);
+    int value;
+    if (expr && evaluate(expr, value)) {
+      mValues[expr] = value;
+      return true;
+    }
+    /// \p stmt has to be evaluated, its constant children are the roots
+    if (constantChild)
+      for (Stmt *child : stmt->children())
+        if (child && mValues.count(child))
+          mConstants[child] = mValues[child];
+    return false;
+  }
+
+public:
+  void run(TranslationUnitDecl *unit) {
+    for (Decl *decl : unit->decls()) {
+      Stmt *root = nullptr;
+      if (FunctionDecl *fdecl = dyn_cast<FunctionDecl>(decl))
+        root = fdecl->doesThisDeclarationHaveABody() ? fdecl->getBody()
+                                                     : nullptr;
+      else if (VarDecl *vdecl = dyn_cast<VarDecl>(decl))
+        root = vdecl->getInit();
+      if (root && fold(root))
+        mConstants[root] = mValues[root];
+    }
+    mValues.clear();
+  }
+
+  /// the value of \p stmt if it is (the root of) a constant subtree
+  const int *lookup(const Stmt *stmt) const {
+    auto it = mConstants.find(stmt);
+    return it == mConstants.end() ? nullptr : &it->second;
+  }
+
+  /// number of constant subtrees
+  unsigned size() const { return mConstants.size(); }
+};
+
+#endif
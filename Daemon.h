@@ -0,0 +1,455 @@
+//==--- Daemon.h - Server that runs programs sent over a Unix socket -------==//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_DAEMON_H
+#define AST_INTERPRETER_DAEMON_H
+
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <poll.h>
+#include <pthread.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "clang/Basic/Diagnostic.h"
+#include "clang/Basic/DiagnosticOptions.h"
+#include "clang/Frontend/ASTUnit.h"
+#include "clang/Frontend/TextDiagnosticPrinter.h"
+#include "clang/Tooling/Tooling.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "ASTCache.h"
+#include "Snapshot.h"
+#include "Trace.h"
+
+using namespace clang;
+
+/// A program and what GET reads while it runs
+struct Job {
+  std::string mProgram;
+  std::string mInput;
+};
+
+/// What running a Job produced, what a fresh process would have shown
+struct JobResult {
+  /// 0 if the program ran, 1 if it did not compile or failed
+  int mStatus;
+  /// what `main` returned
+  int mExitCode;
+  /// the interpreter's own output (`--stats`, ...), stdout of the CLI
+  std::string mOut;
+  /// compiler diagnostics and the PRINT output, stderr of the CLI
+  std::string mErr;
+
+  JobResult() : mStatus(0), mExitCode(0), mOut(), mErr() {}
+};
+
+/// The protocol of `--serve`: one job per connection. The client sends two
+/// frames, the program and its input; the server answers with the status
+/// and the exit code, then two frames, the output and the error output.
+/// A frame is a uint32 length followed by that many bytes, and integers are
+/// in the byte order of the host, which both ends share.
+namespace wire {
+/// frames larger than this are refused
+static const uint32_t MAX_FRAME = 64 << 20;
+
+inline bool readAll(int fd, void *data, size_t len) {
+  char *bytes = (char *)data;
+  while (len > 0) {
+    ssize_t n = ::recv(fd, bytes, len, 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    bytes += n;
+    len -= n;
+  }
+  return true;
+}
+/// never raises SIGPIPE, a client may be gone
+inline bool writeAll(int fd, const void *data, size_t len) {
+  const char *bytes = (const char *)data;
+  while (len > 0) {
+    ssize_t n = ::send(fd, bytes, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    bytes += n;
+    len -= n;
+  }
+  return true;
+}
+
+inline bool readInt(int fd, int32_t &val) {
+  return readAll(fd, &val, sizeof(val));
+}
+inline bool writeInt(int fd, int32_t val) {
+  return writeAll(fd, &val, sizeof(val));
+}
+inline bool readFrame(int fd, std::string &frame) {
+  uint32_t len;
+  if (!readAll(fd, &len, sizeof(len)) || len > MAX_FRAME)
+    return false;
+  frame.resize(len);
+  return readAll(fd, &frame[0], len);
+}
+inline bool writeFrame(int fd, llvm::StringRef frame) {
+  uint32_t len = frame.size();
+  return writeAll(fd, &len, sizeof(len)) &&
+         writeAll(fd, frame.data(), frame.size());
+}
+
+/// a socket at \p path, connected or listening; -1 on failure
+inline int openSocket(const std::string &path, bool listening) {
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path))
+    return -1;
+  strcpy(addr.sun_path, path.c_str());
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+  bool ok;
+  if (listening) {
+    /// left over by a server that was killed
+    unlink(path.c_str());
+    ok = bind(fd, (sockaddr *)&addr, sizeof(addr)) == 0 &&
+         listen(fd, SOMAXCONN) == 0;
+  } else {
+    ok = connect(fd, (sockaddr *)&addr, sizeof(addr)) == 0;
+  }
+  if (!ok) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+} // namespace wire
+
+/// A program the server parsed, shared by the jobs that run it
+class Program {
+  std::unique_ptr<ASTUnit> mUnit;
+  std::mutex mLock;
+  std::shared_ptr<const InitImage> mImage;
+
+public:
+  explicit Program(std::unique_ptr<ASTUnit> unit)
+      : mUnit(std::move(unit)), mLock(), mImage() {}
+
+  ASTContext &getASTContext() { return mUnit->getASTContext(); }
+
+  /// the state after the global initializers, null until a job saved it
+  /// (`--snapshot`)
+  std::shared_ptr<const InitImage> getImage() {
+    std::lock_guard<std::mutex> guard(mLock);
+    return mImage;
+  }
+  /// the first image saved is kept, they are all the same
+  void setImage(std::shared_ptr<const InitImage> image) {
+    std::lock_guard<std::mutex> guard(mLock);
+    if (!mImage)
+      mImage = image;
+  }
+};
+
+/// The ASTs of the programs run recently, most recent first, keyed by the
+/// hash of their source like the files of ASTCache. A program is parsed
+/// once while it stays among the last mCapacity distinct programs.
+///
+/// The ASTs are shared: the interpreter only reads an AST, so the workers
+/// run the same program at the same time. An AST that is evicted lives on
+/// until the jobs using it finish.
+class ProgramCache {
+  typedef std::pair<std::string, std::shared_ptr<Program>> Entry;
+
+  std::mutex mLock;
+  std::list<Entry> mLRU;
+  std::unordered_map<std::string, std::list<Entry>::iterator> mIndex;
+  size_t mCapacity;
+  unsigned long long mHits;
+  unsigned long long mMisses;
+
+  /// \p code parsed, with the diagnostics in \p diags; null if it has
+  /// errors
+  static std::shared_ptr<Program> parse(llvm::StringRef code,
+                                        std::string &diags) {
+    llvm::raw_string_ostream os(diags);
+    TextDiagnosticPrinter printer(os, new DiagnosticOptions());
+    std::unique_ptr<ASTUnit> unit(tooling::buildASTFromCodeWithArgs(
+        code, ASTCache::args(), ASTCache::fileName(), "clang-tool",
+        std::make_shared<PCHContainerOperations>(),
+        tooling::getClangStripDependencyFileAdjuster(),
+        tooling::FileContentMappings(), &printer));
+    os.flush();
+    if (!unit || unit->getDiagnostics().hasErrorOccurred())
+      return nullptr;
+    /// the printer dies with this call, the AST may live on in the cache
+    unit->getDiagnostics().setClient(new IgnoringDiagConsumer(), true);
+    return std::make_shared<Program>(std::move(unit));
+  }
+
+public:
+  explicit ProgramCache(size_t capacity)
+      : mLock(), mLRU(), mIndex(), mCapacity(capacity), mHits(0),
+        mMisses(0) {}
+
+  /// \p code, parsed if it is not cached; null if it does not compile, with
+  /// the diagnostics in \p diags
+  std::shared_ptr<Program> get(llvm::StringRef code, std::string &diags) {
+    std::string key = ASTCache::hashOf(code);
+    {
+      std::lock_guard<std::mutex> guard(mLock);
+      auto it = mIndex.find(key);
+      if (it != mIndex.end()) {
+        mLRU.splice(mLRU.begin(), mLRU, it->second);
+        ++mHits;
+        return it->second->second;
+      }
+      ++mMisses;
+    }
+    /// parsing takes long, other workers go on meanwhile; if two parse the
+    /// same program, the first one is kept
+    std::shared_ptr<Program> program = parse(code, diags);
+    if (!program)
+      return nullptr;
+    std::lock_guard<std::mutex> guard(mLock);
+    auto it = mIndex.find(key);
+    if (it != mIndex.end())
+      return it->second->second;
+    mLRU.emplace_front(key, program);
+    mIndex[key] = mLRU.begin();
+    while (mLRU.size() > mCapacity) {
+      mIndex.erase(mLRU.back().first);
+      mLRU.pop_back();
+    }
+    return program;
+  }
+
+  void printStats(llvm::raw_ostream &os) {
+    std::lock_guard<std::mutex> guard(mLock);
+    os << "programs: hits=" << mHits << " misses=" << mMisses
+       << " cached=" << mLRU.size() << "\n";
+  }
+};
+
+/// The input and output files of one job: GET reads a file holding the
+/// input of the job, PRINT writes into another, like BatchFiles. Both are
+/// anonymous temporary files that vanish when they are closed.
+class JobFiles {
+  FILE *mIn;
+  FILE *mOut;
+
+public:
+  explicit JobFiles(const std::string &input)
+      : mIn(tmpfile()), mOut(tmpfile()) {
+    if (mIn && (fwrite(input.data(), 1, input.size(), mIn) != input.size() ||
+                fflush(mIn) != 0 || fseek(mIn, 0, SEEK_SET) != 0)) {
+      fclose(mIn);
+      mIn = nullptr;
+    }
+  }
+  ~JobFiles() {
+    if (mIn)
+      fclose(mIn);
+    if (mOut)
+      fclose(mOut);
+  }
+  JobFiles(const JobFiles &) = delete;
+  JobFiles &operator=(const JobFiles &) = delete;
+
+  bool ok() const { return mIn && mOut; }
+  int inFd() const { return fileno(mIn); }
+  int outFd() const { return fileno(mOut); }
+
+  /// append what was written to the output file to \p out
+  void readOutput(std::string &out) {
+    off_t len = lseek(outFd(), 0, SEEK_END);
+    if (len <= 0)
+      return;
+    size_t start = out.size();
+    out.resize(start + len);
+    if (pread(outFd(), &out[start], len, 0) != len)
+      out.resize(start);
+  }
+};
+
+/// `--serve=<socket>`: accepts jobs on a Unix socket and runs them on a
+/// fixed pool of worker threads until SIGINT or SIGTERM. Every job runs in
+/// a fresh Environment like a fresh process would, only the parsing is
+/// shared through the ProgramCache. What interprets a job is up to mRunner,
+/// which gets the Program and the file descriptors GET and PRINT use.
+class Daemon {
+public:
+  typedef std::function<void(Program &, int inFd, int outFd, JobResult &)>
+      Runner;
+
+private:
+  std::string mPath;
+  unsigned mNumWorkers;
+  ProgramCache mPrograms;
+  Runner mRunner;
+
+  /// accepted connections waiting for a worker, -1 tells a worker to stop
+  std::mutex mQueueLock;
+  std::condition_variable mQueueReady;
+  std::deque<int> mQueue;
+
+  static volatile sig_atomic_t &stopping() {
+    static volatile sig_atomic_t flag = 0;
+    return flag;
+  }
+  static void onSignal(int) { stopping() = 1; }
+
+  void push(int fd) {
+    {
+      std::lock_guard<std::mutex> guard(mQueueLock);
+      mQueue.push_back(fd);
+    }
+    mQueueReady.notify_one();
+  }
+  int pop() {
+    std::unique_lock<std::mutex> guard(mQueueLock);
+    mQueueReady.wait(guard, [this] { return !mQueue.empty(); });
+    int fd = mQueue.front();
+    mQueue.pop_front();
+    return fd;
+  }
+
+  JobResult run(const Job &job) {
+    JobResult result;
+    std::shared_ptr<Program> program =
+        mPrograms.get(job.mProgram, result.mErr);
+    if (!program) {
+      result.mStatus = 1;
+      return result;
+    }
+    JobFiles files(job.mInput);
+    if (!files.ok()) {
+      result.mErr += "cannot create the files of the job\n";
+      result.mStatus = 1;
+      return result;
+    }
+    mRunner(*program, files.inFd(), files.outFd(), result);
+    files.readOutput(result.mErr);
+    return result;
+  }
+
+  void work() {
+    for (int fd; (fd = pop()) >= 0; close(fd)) {
+      Job job;
+      if (!wire::readFrame(fd, job.mProgram) ||
+          !wire::readFrame(fd, job.mInput))
+        continue;
+      JobResult result = run(job);
+      ASTI_TRACE(TL_Info, "job done with status " << result.mStatus << "\n");
+      /// the client may have given up, nothing to do about it
+      (void)(wire::writeInt(fd, result.mStatus) &&
+             wire::writeInt(fd, result.mExitCode) &&
+             wire::writeFrame(fd, result.mOut) &&
+             wire::writeFrame(fd, result.mErr));
+    }
+  }
+
+public:
+  Daemon(const std::string &path, unsigned workers, size_t programs,
+         Runner runner)
+      : mPath(path), mNumWorkers(workers ? workers : 1), mPrograms(programs),
+        mRunner(runner), mQueueLock(), mQueueReady(), mQueue() {}
+
+  /// serve until SIGINT or SIGTERM; false if the socket cannot be opened
+  bool serve() {
+    int listener = wire::openSocket(mPath, true);
+    if (listener < 0) {
+      llvm::errs() << "cannot listen on " << mPath << ": "
+                   << strerror(errno) << "\n";
+      return false;
+    }
+    /// the stop signals stay blocked, in the workers they inherit the mask
+    /// and in this thread until ppoll() unblocks them while it waits, so a
+    /// signal can only arrive while nothing but the wait is pending
+    sigset_t stopSignals, old, waiting;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, &old);
+    waiting = old;
+    sigdelset(&waiting, SIGINT);
+    sigdelset(&waiting, SIGTERM);
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < mNumWorkers; i++)
+      workers.emplace_back([this] { work(); });
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onSignal;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    /// a client may give up between ppoll() and accept(), which must not
+    /// block then
+    fcntl(listener, F_SETFL, fcntl(listener, F_GETFL) | O_NONBLOCK);
+    ASTI_TRACE(TL_Info, "serving " << mPath << " with " << mNumWorkers
+                                   << " workers\n");
+
+    while (!stopping()) {
+      pollfd ready = {listener, POLLIN, 0};
+      if (ppoll(&ready, 1, nullptr, &waiting) < 0) {
+        if (errno != EINTR)
+          llvm::errs() << "warning: poll failed: " << strerror(errno)
+                       << "\n";
+        continue;
+      }
+      /// the accepted socket does not inherit O_NONBLOCK
+      int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+      if (fd >= 0)
+        push(fd);
+      else if (errno != EINTR && errno != ECONNABORTED && errno != EAGAIN &&
+               errno != EWOULDBLOCK)
+        llvm::errs() << "warning: accept failed: " << strerror(errno)
+                     << "\n";
+    }
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+    close(listener);
+    unlink(mPath.c_str());
+    /// the jobs that were accepted still run
+    for (unsigned i = 0; i < mNumWorkers; i++)
+      push(-1);
+    for (std::thread &worker : workers)
+      worker.join();
+    mPrograms.printStats(llvm::errs());
+    return true;
+  }
+
+  /// `--connect=<socket>`: run \p job on the server at \p path; false if
+  /// the server cannot be reached or hung up
+  static bool submit(const std::string &path, const Job &job,
+                     JobResult &result) {
+    int fd = wire::openSocket(path, false);
+    if (fd < 0)
+      return false;
+    bool ok = wire::writeFrame(fd, job.mProgram) &&
+              wire::writeFrame(fd, job.mInput) &&
+              wire::readInt(fd, result.mStatus) &&
+              wire::readInt(fd, result.mExitCode) &&
+              wire::readFrame(fd, result.mOut) &&
+              wire::readFrame(fd, result.mErr);
+    close(fd);
+    return ok;
+  }
+};
+
+#endif
@@ -1,6 +1,13 @@
 //==--- tools/clang-check/ClangInterpreter.cpp - Clang Interpreter tool
 //--------------===//
 //===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_ENVIRONMENT_H
+#define AST_INTERPRETER_ENVIRONMENT_H
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <csignal>
 #include <exception>
 #include <stdio.h>
 #include <vector>
@@ -12,210 +19,501 @@
 #include "clang/Frontend/FrontendAction.h"
 #include "clang/Tooling/Tooling.h"
 
+#include "BuiltinIO.h"
+#include "Builtins.h"
+#include "ConstantFolder.h"
+#include "FrameArena.h"
+#include "Heap.h"
+#include "LoopIdiom.h"
+#include "Memo.h"
+#include "Memory.h"
+#include "Profiler.h"
+#include "Quicken.h"
+#include "Resolver.h"
+#include "SIMD.h"
+#include "Snapshot.h"
+#include "Trace.h"
+
 using namespace clang;
 
 // class Environment;
 class StackFrame {
   // friend class Environment;
-  /// StackFrame maps Variable Declaration to Value
-  /// Which are either integer or addresses (also represented using an Integer
-  /// value)
-  std::map<Decl *, int> mVars;
-  std::map<Stmt *, int> mExprs;
+  /// StackFrame holds the values of the variables of one function, indexed
+  /// by the slots the Resolver assigned. Values are either integer or
+  /// addresses (also represented using an Integer value)
+  int *mSlots;
+  /// values of the expressions evaluated in this frame, indexed by the
+  /// numbers the Resolver gave the nodes. Lives right after mSlots.
+  int *mTemps;
+  unsigned mNumSlots;
+  unsigned mNumTemps;
+  /// where the variables of the frame that live in Memory start
+  Memory::Addr mMemBase;
   /// The current stmt
   Stmt *mPC;
+  /// the function running in this frame, null for the global frame
+  FunctionDecl *mFunction;
+  /// numbers the nodes of mFunction (or the global initializers)
+  const FrameLayout *mLayout;
 
 public:
-  StackFrame() : mVars(), mExprs(), mPC() {}
-
-  bool hasDecl(Decl *decl) { return mVars.find(decl) != mVars.end(); }
-  void bindDecl(Decl *decl, int val) { mVars[decl] = val; }
-  int getDeclVal(Decl *decl) {
-    assert(mVars.find(decl) != mVars.end());
-    return mVars.find(decl)->second;
-  }
-
-  bool hasStmt(Stmt *stmt) { return mExprs.find(stmt) != mExprs.end(); }
-  void bindStmt(Stmt *stmt, int val) { mExprs[stmt] = val; }
-  int getStmtVal(Stmt *stmt) {
-    // IntegerLiteral *pi;
-    // if ((pi = dyn_cast<IntegerLiteral>(stmt))) {
-    //   return pi->getValue().getSExtValue();
-    // }
-    if(!hasStmt(stmt)) {
-      llvm::outs() << "We cannot find the value of below stmt:\n";
-      stmt->dump();
-    }
-    assert(mExprs.find(stmt) != mExprs.end());
-    return mExprs[stmt];
+  /// a zeroed frame in \p arena, it lives until it is released with
+  /// `release()`
+  StackFrame(FrameArena &arena, const FrameLayout &layout,
+             Memory::Addr memBase, FunctionDecl *function = nullptr)
+      : mSlots(arena.push(layout.mNumSlots + layout.mNumTemps)),
+        mTemps(mSlots + layout.mNumSlots), mNumSlots(layout.mNumSlots),
+        mNumTemps(layout.mNumTemps), mMemBase(memBase), mPC(),
+        mFunction(function), mLayout(&layout) {}
+
+  void release(FrameArena &arena) { arena.pop(mSlots); }
+
+  void setSlot(unsigned idx, int val) {
+    assert(idx < mNumSlots);
+    mSlots[idx] = val;
   }
-
-  void setPC(Stmt *stmt) { mPC = stmt; }
-  Stmt *getPC() { return mPC; }
-};
-
-/// Heap maps address to a value
-class Heap {
-public:
-  typedef int HeapAddr;
-private:
-  /// In this simple heap implementation, we malloc a space.
-  /// And we will keep it until the interpreter exits
-  static const HeapAddr INIT_HEAP_SIZE = sizeof(int) * 1024; 
-  void *mHeapPtr;
-  HeapAddr mOffset;
-
-  inline int* actualAddr(HeapAddr addr) {
-    assert(addr <= INIT_HEAP_SIZE);
-    return (int*)((char*)mHeapPtr+addr);
+  int getSlot(unsigned idx) {
+    assert(idx < mNumSlots);
+    return mSlots[idx];
   }
-public:
-    
-    Heap():mHeapPtr(malloc(INIT_HEAP_SIZE)), mOffset(0) {}
-    ~Heap(){ free(mHeapPtr); }
-    HeapAddr Malloc(int size) {
-      HeapAddr ret = mOffset;
-      mOffset =+ size;
-      llvm::outs() << "allocate size=" << size << ", return address=" << ret << ", still have " << INIT_HEAP_SIZE-mOffset << "\n";
-      assert(mOffset <= INIT_HEAP_SIZE);
-      return ret;
-    }
-    void Free (HeapAddr addr) {
-      /// do nothing?
-      /// this naive implementation will run out of memory when we simply keep malloc then free.
-    }
-    void Update(HeapAddr addr, int val) {
-      int * ptr = actualAddr(addr);
-      *ptr = val;
-      llvm::outs() << "Update *" << addr << " -> " << val << "\n";
-    }
-    int get(HeapAddr addr) {
-      int * ptr = actualAddr(addr);
-      return *ptr;
-    }
-    /// sizeof(int*)
-    static int getPtrSize() {
-      return sizeof(HeapAddr);
-    }
 
-    /// (int*)x + 1, we need to increment 4!
-    static int step2Size(int step) {
-      return step * getPtrSize();
-    }
-};
-
-
-class ReturnException : public std::exception {
-  int mRet;
-
-public:
-  ReturnException(int ret) : mRet(ret) {}
-
-  int getRetVal() { return mRet; }
-};
-
-class Array {
-  int mScope;
-  std::vector<int> mArr;
-public:
-  Array(int sz, int scope):mArr(sz), mScope(scope) {}
-  void set(int i, int val) {
-    assert(i <= mArr.size());
-    mArr[i] = val;
+  void setTemp(unsigned idx, int val) {
+    assert(idx < mNumTemps);
+    mTemps[idx] = val;
   }
-  int get(int i) {
-    assert(i <= mArr.size());
-    return mArr[i];
+  int getTemp(unsigned idx) {
+    assert(idx < mNumTemps);
+    return mTemps[idx];
   }
+  int *slotData() { return mSlots; }
+  int *tempData() { return mTemps; }
+  unsigned getNumSlots() const { return mNumSlots; }
+  Memory::Addr getMemBase() const { return mMemBase; }
+
+  void setPC(Stmt *stmt) { mPC = stmt; }
+  Stmt *getPC() { return mPC; }
+  const Stmt *getPC() const { return mPC; }
+  FunctionDecl *getFunction() { return mFunction; }
+  const FunctionDecl *getFunction() const { return mFunction; }
+  const FrameLayout &getLayout() const { return *mLayout; }
 };
 
+/// How the execution of a statement completed. Anything but CK_Normal makes
+/// the enclosing statements stop until the loop or call that handles it.
+/// CK_TailCall is a return whose callee already took over the frame and now
+/// has to run in its place.
+enum Completion { CK_Normal, CK_Return, CK_Break, CK_Continue, CK_TailCall };
+
 class InterpreterVisitor;
 class Environment {
   EvaluatedExprVisitor<InterpreterVisitor> * mInterpreter;
 
+  Memory mMemory;
   Heap mHeap;
+  BuiltinIO mIO;
+  Resolver mResolver;
+  ConstantFolder mFolder;
+  IdiomRecognizer mIdioms;
+  /// storage of the frames, must outlive mStack
+  FrameArena mFrames;
+  /// frame headers, the values themselves are in mFrames
   std::vector<StackFrame> mStack;
-  std::vector<Array> mArrays;
 
-  FunctionDecl *mFree; /// Declartions to the built-in functions
-  FunctionDecl *mMalloc;
-  FunctionDecl *mInput;
-  FunctionDecl *mOutput;
+  /// what every call does: builtin, native or interpreted
+  BuiltinRegistry mBuiltins;
+  /// results of the calls to pure functions, null unless enableMemo()
+  std::unique_ptr<MemoCache> mMemo;
+  PurityAnalysis mPurity;
 
   FunctionDecl *mEntry;
 
+  /// number of the node the walker visits next, in the frame on top of the
+  /// stack; set right before the visit, see FrameLayout
+  unsigned mCurrentNode;
+  /// value of the last executed `return`
+  int mRetVal;
+  /// arguments of a tail call while the frames are swapped
+  std::vector<int> mTailArgs;
+  /// work done so far for `--stats`: expressions evaluated by the walker,
+  /// instructions executed by the bytecode engine
+  unsigned long long mNodes;
+  /// GET, PRINT or a native function was called, so the state after init()
+  /// is not an InitImage
+  bool mSideEffects;
+  /// the specialized handlers of the operator nodes, by the index of the
+  /// FrameLayout and then by node; a table is filled on first use
+  std::vector<std::vector<QuickOp>> mQuick;
+  /// times the calls for `--profile`, null otherwise
+  Profiler *mProfiler;
+  /// set while mStack is being changed, so a signal handler reading it
+  /// (the Sampler) knows it is not consistent
+  volatile sig_atomic_t mStackChanging;
+
+  /// marks mStack as changing for as long as it lives
+  class StackChange {
+    volatile sig_atomic_t &mFlag;
+
+  public:
+    explicit StackChange(volatile sig_atomic_t &flag) : mFlag(flag) {
+      mFlag = 1;
+      std::atomic_signal_fence(std::memory_order_seq_cst);
+    }
+    ~StackChange() {
+      std::atomic_signal_fence(std::memory_order_seq_cst);
+      mFlag = 0;
+    }
+  };
+
 public:
   void setInterpreter(EvaluatedExprVisitor<InterpreterVisitor> * visitor) {
     this->mInterpreter = visitor;
   }
-  void stackPop() { 
+  void stackPop() {
+    if (mProfiler)
+      mProfiler->leaveFunction();
+    mMemory.stackRelease(mStack.back().getMemBase());
+    mStack.back().release(mFrames);
+    StackChange change(mStackChanging);
     mStack.pop_back();
-    //TODO: clear array
   }
 
   StackFrame &stackTop() { return mStack.back(); }
 
   StackFrame &globalScope() { return mStack[0]; } 
 
-  void bindDecl(Decl *decl, int val) { 
-    if(stackTop().hasDecl(decl)) {
-      stackTop().bindDecl(decl, val);
-    } else {
-      /// it should be a global variable
-      llvm::outs() << "bind global decl\n";
-      globalScope().bindDecl(decl, val);
-    }
+  /// the frames of the active calls, the global frame first; only valid
+  /// while isStackChanging() is false
+  const std::vector<StackFrame> &getStack() const { return mStack; }
+  bool isStackChanging() const { return mStackChanging; }
+
+  const Resolver &getResolver() const { return mResolver; }
+  const ConstantFolder &getFolder() const { return mFolder; }
+  const IdiomRecognizer &getIdioms() const { return mIdioms; }
+  Memory &getMemory() { return mMemory; }
+  Heap &getHeap() { return mHeap; }
+  BuiltinIO &getIO() { return mIO; }
+  FrameArena &getFrames() { return mFrames; }
+
+  /// the frame a resolved variable lives in
+  StackFrame &frameOf(VarSlot slot) {
+    return slot.mGlobal ? globalScope() : stackTop();
+  }
+
+  /// address of a variable that lives in Memory
+  Memory::Addr varAddr(VarSlot slot) {
+    assert(slot.mInMemory);
+    return frameOf(slot).getMemBase() + slot.mOffset;
+  }
+
+  /// the value of type \p type at \p addr; an array evaluates to its address
+  int load(Memory::Addr addr, QualType type) {
+    if (type->isArrayType())
+      return addr;
+    int size = typeSize(type);
+    if (size == sizeof(int))
+      return mMemory.loadInt(addr);
+    return mMemory.load(addr, size, type->isSignedIntegerType());
   }
-  int getDeclVal(Decl *decl) {
-    if(stackTop().hasDecl(decl)) {
-      return stackTop().getDeclVal(decl);
-    } else {
-      /// it should be a global variable
-      // llvm::outs() << "get global decl\n";
-      // decl->dump();
-      return globalScope().getDeclVal(decl);
+  void store(Memory::Addr addr, QualType type, int val) {
+    mMemory.store(addr, val, typeSize(type));
+  }
+
+  /// the variable the DeclRefExpr numbered \p node refers to
+  VarSlot refSlot(unsigned node) {
+    return stackTop().getLayout().mRefSlots[node];
+  }
+  /// the variable in \p slot, of type \p type
+  void bindVar(VarSlot slot, QualType type, int val) {
+    if (slot.mGlobal) {
+      ASTI_TRACE(TL_Trace, "bind global decl\n");
     }
+    if (slot.mInMemory)
+      store(varAddr(slot), type, val);
+    else
+      frameOf(slot).setSlot(slot.mIndex, val);
+  }
+  int getVarVal(VarSlot slot, QualType type) {
+    if (slot.mInMemory)
+      return load(varAddr(slot), type);
+    return frameOf(slot).getSlot(slot.mIndex);
   }
-  void bindStmt(Stmt *stmt, int val) { stackTop().bindStmt(stmt, val); }
-  int getStmtVal(Stmt *stmt) {
-    return stackTop().getStmtVal(stmt);
+  /// the value of the node numbered \p node of the frame on top of the stack
+  void bindNode(unsigned node, int val) {
+    ++mNodes;
+    stackTop().setTemp(node, val);
   }
+  int getNodeVal(unsigned node) { return stackTop().getTemp(node); }
+
+  void setCurrentNode(unsigned node) { mCurrentNode = node; }
+  unsigned getCurrentNode() const { return mCurrentNode; }
 
   static const int SCH001 = 11217991;
+  /// frame headers reserved up front, so usual call depths never regrow mStack
+  static const size_t STACK_RESERVE = 4096;
   /// Get the declartions to the built-in functions
-  Environment()
-      : mStack(), mFree(NULL), mMalloc(NULL), mInput(NULL), mOutput(NULL),
-        mEntry(NULL) {}
+  /// \p stackBudget bytes are available to the frames of the active calls,
+  /// GET reads \p inFd and PRINT writes \p outFd
+  explicit Environment(size_t stackBudget = FrameArena::DEFAULT_BUDGET,
+                       int inFd = 0, int outFd = 2)
+      : mMemory(), mHeap(mMemory), mIO(inFd, outFd), mResolver(), mFolder(),
+        mIdioms(mResolver, mFolder), mFrames(stackBudget),
+        mStack(), mBuiltins(), mMemo(), mPurity(mResolver, mBuiltins),
+        mEntry(NULL), mCurrentNode(0), mRetVal(0), mNodes(0), mSideEffects(false),
+        mProfiler(nullptr), mStackChanging(0) {
+    mStack.reserve(STACK_RESERVE);
+  }
 
-  /// Initialize the Environment
-  void init(TranslationUnitDecl *unit) {
-    mStack.push_back(StackFrame());
+  /// Initialize the Environment. The global initializers run unless
+  /// \p restore is a valid image of this program, which is taken instead;
+  /// the state they leave is saved into \p save if it is not null. Returns
+  /// whether \p restore was taken.
+  bool init(TranslationUnitDecl *unit, const InitImage *restore = nullptr,
+            InitImage *save = nullptr) {
+    /// before the global initializers run, so they are folded too, and
+    /// before the Resolver, which keeps the values by node
+    mFolder.run(unit);
+    const ConstantFolder &folder = mFolder;
+    mResolver.resolve(unit, [&folder](const Stmt *stmt) {
+      return folder.lookup(stmt);
+    });
+    mQuick.resize(mResolver.getNumLayouts());
+    mBuiltins.resolve(unit);
+    mIdioms.run(unit);
+    if (mMemo)
+      mPurity.run(unit);
+    const FrameLayout &globals = mResolver.getGlobalLayout();
+    mStack.push_back(
+        StackFrame(mFrames, globals, mMemory.globalAlloc(globals.mMemSize)));
+    bool restored = restore && restoreInit(*restore);
+    /// the Resolver numbered the initializers one after the other
+    unsigned initNode = 0;
     for (TranslationUnitDecl::decl_iterator i = unit->decls_begin(),
                                             e = unit->decls_end();
          i != e; ++i) {
       if (FunctionDecl *fdecl = dyn_cast<FunctionDecl>(*i)) {
-        if (fdecl->getName().equals("FREE"))
-          mFree = fdecl;
-        else if (fdecl->getName().equals("MALLOC"))
-          mMalloc = fdecl;
-        else if (fdecl->getName().equals("GET"))
-          mInput = fdecl;
-        else if (fdecl->getName().equals("PRINT"))
-          mOutput = fdecl;
-        else if (fdecl->getName().equals("main"))
+        if (fdecl->getName().equals("main"))
           mEntry = fdecl;
       } else if(VarDecl *vdecl = dyn_cast<VarDecl>(*i)) {
         /// global variable?
-        this->handleVarDecl(vdecl);
+        if (!restored)
+          this->handleVarDecl(vdecl, initNode);
+        if (vdecl->getInit())
+          initNode = globals.next(initNode);
       }
     }
+    if (save && !restored)
+      saveInit(*save);
+    return restored;
+  }
+
+  /// the state after the global initializers, see Snapshot.h
+  void saveInit(InitImage &image) {
+    StackFrame &globals = globalScope();
+    image.mValid = !mSideEffects;
+    if (!image.mValid)
+      return;
+    image.mNodes = mNodes;
+    image.mGlobalSlots.assign(globals.slotData(),
+                              globals.slotData() + globals.getNumSlots());
+    image.mGlobals.assign(mMemory.data() + globals.getMemBase(),
+                          mResolver.getGlobalLayout().mMemSize);
+    image.mHeap = mHeap.save();
+    image.mHeapBytes = mHeap.bytes().str();
+  }
+  /// take the state after the global initializers from \p image instead of
+  /// running them; false if it does not fit this program
+  bool restoreInit(const InitImage &image) {
+    StackFrame &globals = globalScope();
+    if (!image.mValid || image.mGlobalSlots.size() != globals.getNumSlots() ||
+        image.mGlobals.size() != mResolver.getGlobalLayout().mMemSize ||
+        !mHeap.restore(image.mHeap, image.mHeapBytes))
+      return false;
+    std::copy(image.mGlobalSlots.begin(), image.mGlobalSlots.end(),
+              globals.slotData());
+    memcpy(mMemory.data() + globals.getMemBase(), image.mGlobals.data(),
+           image.mGlobals.size());
+    mNodes = image.mNodes;
+    ASTI_TRACE(TL_Info, "global initializers restored from a snapshot\n");
+    return true;
   }
 
   FunctionDecl *getEntry() { return mEntry; }
 
-  void uop(UnaryOperator * uop) {
+  unsigned long long getNodes() const { return mNodes; }
+  void addNodes(unsigned long long nodes) { mNodes += nodes; }
+
+  void setProfiler(Profiler *profiler) { mProfiler = profiler; }
+
+  /// answer the calls to pure functions from a cache of \p entries results
+  /// (see Memo.h); before init()
+  void enableMemo(unsigned entries) { mMemo.reset(new MemoCache(entries)); }
+  void printMemoStats(llvm::raw_ostream &os) const {
+    if (mMemo)
+      mMemo->printStats(os, mPurity.size());
+  }
+
+  /// push a frame sized for \p fdecl, e.g. for `main`
+  void stackPush(FunctionDecl *fdecl) {
+    const FrameLayout &layout = mResolver.getLayout(fdecl);
+    StackFrame frame(mFrames, layout, mMemory.stackAlloc(layout.mMemSize),
+                     fdecl);
+    {
+      StackChange change(mStackChanging);
+      mStack.push_back(frame);
+    }
+    if (mProfiler)
+      mProfiler->enterFunction(fdecl);
+  }
+
+  /// The QuickOp of \p expr, the node numbered \p node, specialized on its
+  /// first evaluation; its kernel is null if \p expr has no specialized
+  /// handler.
+  const QuickOp &quicken(Expr *expr, unsigned node) {
+    const FrameLayout &layout = stackTop().getLayout();
+    std::vector<QuickOp> &table = mQuick[layout.mIndex];
+    if (table.empty())
+      table.resize(layout.mNumTemps);
+    QuickOp &quick = table[node];
+    if (quick.mScale)
+      return quick;
+    quick = QuickOp{nullptr, node, 0, 0, 1};
+    if (BinaryOperator *bop = dyn_cast<BinaryOperator>(expr)) {
+      Expr *left = bop->getLHS();
+      Expr *right = bop->getRHS();
+      quick.mKernel = selectKernel(bop->getOpcode(), operandKind(left),
+                                   operandKind(right));
+      quick.mLHS = node + 1;
+      quick.mRHS = layout.next(node + 1);
+      if (bop->isAdditiveOp() && left->getType()->isPointerType())
+        quick.mScale = typeSize(left->getType()->getPointeeType());
+      else if (bop->isAdditiveOp() && right->getType()->isPointerType())
+        quick.mScale = typeSize(right->getType()->getPointeeType());
+    } else if (UnaryOperator *uop = dyn_cast<UnaryOperator>(expr)) {
+      quick.mKernel = selectKernel(uop->getOpcode());
+      quick.mLHS = quick.mRHS = node + 1;
+    }
+    return quick;
+  }
+
+  /// the variable \p slot of the frame whose slots start at \p slots
+  int &idiomSlot(VarSlot slot, int *slots) {
+    return slot.mGlobal ? globalScope().slotData()[slot.mIndex]
+                        : slots[slot.mIndex];
+  }
+  int idiomOperand(const IdiomOperand &op, int *slots, Memory::Addr mem) {
+    switch (op.mKind) {
+    case IdiomOperand::IO_Imm:
+      return op.mImm;
+    case IdiomOperand::IO_Var:
+      return idiomSlot(op.mSlot, slots);
+    case IdiomOperand::IO_Array:
+      return (op.mSlot.mGlobal ? globalScope().getMemBase() : mem) +
+             op.mSlot.mOffset;
+    }
+    return 0;
+  }
+  /// \p count elements of \p size bytes from \p addr, or null if they are
+  /// not all in the address space
+  char *idiomRange(long long addr, long long count, int size) {
+    if (addr < Memory::GLOBAL_BASE || addr + count * size > Memory::LIMIT)
+      return nullptr;
+    return mMemory.data() + addr;
+  }
+
+  /// Run loop idiom \p idx (see IdiomRecognizer) of a frame, whose slots
+  /// start at \p slots (the registers of the bytecode engine, too) and whose
+  /// Memory is at \p mem, from the value its induction variable has now.
+  /// False if it has to run as a loop after all.
+  bool runIdiom(unsigned idx, int *slots, Memory::Addr mem) {
+    const LoopIdiom &idiom = mIdioms.get(idx);
+    int &index = idiomSlot(idiom.mIndex, slots);
+    long long end = idiomOperand(idiom.mBound, slots, mem);
+    if (idiom.mInclusive) {
+      /// `i <= INT_MAX` never ends
+      if (end == INT_MAX)
+        return false;
+      ++end;
+    }
+    if (index >= end)
+      return true;
+    size_t count = end - index;
+    int size = idiom.mElemSize;
+    char *dst = idiomRange(idiomOperand(idiom.mArray, slots, mem) +
+                               (long long)index * size,
+                           count, size);
+    char *src = nullptr;
+    int val = 0;
+    if (idiom.mOtherIsArray)
+      src = idiomRange(idiomOperand(idiom.mOther, slots, mem) +
+                           (long long)index * size,
+                       count, size);
+    else
+      val = idiomOperand(idiom.mOther, slots, mem);
+    /// the loop fails on the element that is out of range
+    if (!dst || (idiom.mOtherIsArray && !src))
+      return false;
+    const SIMDKernels &simd = simdKernels();
+    switch (idiom.mKind) {
+    case LI_Fill:
+      if (size == 1) {
+        memset(dst, val, count);
+      } else if (size == sizeof(int)) {
+        simd.mFill(dst, count, val);
+      } else {
+        for (size_t i = 0; i < count; i++)
+          mMemory.store(dst - mMemory.data() + i * size, val, size);
+      }
+      break;
+    case LI_Copy:
+      /// copying forwards into a range that starts inside the source
+      /// repeats elements, which memmove does not
+      if (src < dst && dst < src + count * size)
+        return false;
+      memmove(dst, src, count * size);
+      break;
+    case LI_Sum: {
+      int &accum = idiomSlot(idiom.mAccum, slots);
+      accum = (int)((unsigned)accum + (unsigned)simd.mSum(dst, count));
+      break;
+    }
+    case LI_Find:
+      /// i stops at the element that breaks the loop
+      count = src ? simd.mFind(dst, src, count, idiom.mEqual)
+                  : simd.mFindValue(dst, count, val, idiom.mEqual);
+      break;
+    }
+    index += count;
+    ASTI_TRACE(TL_Trace, "loop idiom " << idx << " ran " << count
+                                       << " iterations with " << simd.mName
+                                       << "\n");
+    return true;
+  }
+
+  /// evaluate a node with a specialized handler, its operands are evaluated
+  void runQuick(const QuickOp &quick) {
+    ++mNodes;
+    int *temps = stackTop().tempData();
+    temps[quick.mTemp] =
+        quick.mKernel(temps[quick.mLHS], temps[quick.mRHS], quick.mScale);
+  }
+
+  /// the operands of the node numbered \p node are evaluated, its operand
+  /// is the node after it
+  void uop(UnaryOperator * uop, unsigned node) {
     auto opCode = uop->getOpcode();
-    int val = stackTop().getStmtVal(uop->getSubExpr());
+    if (opCode != UO_AddrOf && opCode != UO_Deref) {
+      const QuickOp &quick = quicken(uop, node);
+      if (quick.mKernel) {
+        runQuick(quick);
+        return;
+      }
+    }
+    if (opCode == UO_AddrOf) {
+      this->bindNode(node, lvalueAddr(uop->getSubExpr(), node + 1));
+      return;
+    }
+    int val = this->getNodeVal(node + 1);
     switch(opCode) {
       case UO_Minus:
         val = -val;
@@ -229,15 +527,34 @@ public:
         val = !val;
         break;
       case UO_Deref:
-        val = mHeap.get(val);
+        val = load(val, uop->getType());
         break;
       default:
         llvm::outs() << "Below uop is not supported: \n";
         uop->dump();
         break;
     }
-    stackTop().bindStmt(uop, val);
+    this->bindNode(node, val);
+  }
+  /// address of the lvalue \p expr numbered \p node, whose operands are
+  /// already evaluated
+  Memory::Addr lvalueAddr(Expr *expr, unsigned node) {
+    Expr *inner = expr->IgnoreParens();
+    node = FrameLayout::descend(expr, node, inner);
+    expr = inner;
+    if (isa<DeclRefExpr>(expr))
+      return varAddr(refSlot(node));
+    if (ArraySubscriptExpr *arrsub = dyn_cast<ArraySubscriptExpr>(expr))
+      return elementAddr(arrsub, node);
+    UnaryOperator *uop = dyn_cast<UnaryOperator>(expr);
+    if (uop && uop->getOpcode() == UO_Deref)
+      return this->getNodeVal(node + 1);
+    llvm::outs() << "Below lvalue is not supported:\n";
+    expr->dump();
+    throw std::exception();
   }
+
+  /// (T*)p + i moves by i * sizeof(T) bytes
   int handleAdditive(int opCode, Expr * left, Expr * right, int lval, int rval) {
     /// handle 
     auto ltype = left->getType();
@@ -246,55 +563,64 @@ public:
     bool rIsPtr = rtype->isPointerType();
     if(lIsPtr && rIsPtr) {
       assert(opCode == BO_Sub);
-      return (lval-rval)/Heap::getPtrSize();
+      return (lval-rval)/typeSize(ltype->getPointeeType());
     } else if(lIsPtr) {
-      rval = Heap::step2Size(rval);
+      rval *= typeSize(ltype->getPointeeType());
     } else if(rIsPtr) {
-      lval = Heap::step2Size(lval);
+      lval *= typeSize(rtype->getPointeeType());
     } /// else both are integers
     if (opCode == BO_Add) return lval + rval;
     else return lval - rval;
   }
   /// !TODO Support comparison operation
-  void binop(BinaryOperator *bop) {
+  /// the operands of \p bop, numbered \p node, are evaluated
+  void binop(BinaryOperator *bop, unsigned node) {
+    if (!bop->isAssignmentOp()) {
+      const QuickOp &quick = quicken(bop, node);
+      if (quick.mKernel) {
+        runQuick(quick);
+        return;
+      }
+    }
     Expr *left = bop->getLHS();
     Expr *right = bop->getRHS();
-    // int lval = stackTop().getStmtVal(left);
-    int rval = stackTop().getStmtVal(right);
+    unsigned leftNode = node + 1;
+    unsigned rightNode = stackTop().getLayout().next(leftNode);
+    // int lval = this->getNodeVal(leftNode);
+    int rval = this->getNodeVal(rightNode);
 
     auto opCode = bop->getOpcode();
     int res = 0;
     if (bop->isAssignmentOp()) {
-      stackTop().bindStmt(left, rval);
-      stackTop().bindStmt(bop, rval); // bop as a whole!
+      this->bindNode(leftNode, rval);
+      this->bindNode(node, rval); // bop as a whole!
       if (DeclRefExpr *declexpr = dyn_cast<DeclRefExpr>(left)) {
-        Decl *decl = declexpr->getFoundDecl();
-        this->bindDecl(decl, rval);
+        this->bindVar(refSlot(leftNode), declexpr->getDecl()->getType(),
+                      rval);
       } else if(ArraySubscriptExpr * arrsub = dyn_cast<ArraySubscriptExpr>(left)) {
-        auto& arr = getArray(arrsub);
-        auto idx = getArrayIdx(arrsub);
-        arr.set(idx, rval);
-        this->bindStmt(arrsub, rval);
+        store(elementAddr(arrsub, leftNode), arrsub->getType(), rval);
+        this->bindNode(leftNode, rval);
       } else if(UnaryOperator * uop = dyn_cast<UnaryOperator>(left)) {
         assert(uop->getOpcode() == UO_Deref); /// currently supported
-        int addr = stackTop().getStmtVal(uop->getSubExpr());
-        mHeap.Update(addr, rval);
-        this->bindStmt(uop, rval); /// `*ptr = VAL;` should return VAL
+        int addr = this->getNodeVal(leftNode + 1);
+        store(addr, uop->getType(), rval);
+        this->bindNode(leftNode, rval); /// `*ptr = VAL;` should return VAL
       } else {
         llvm::outs() << "Below Assignment(LHS) is Not Supported\n";
         left->dump();
       }
     } else if (bop->isAdditiveOp()) {
-      int lval = stackTop().getStmtVal(left);
+      int lval = this->getNodeVal(leftNode);
       res = handleAdditive(opCode, left, right, lval, rval);
-      stackTop().bindStmt(bop, res);
+      this->bindNode(node, res);
     } else if (bop->isMultiplicativeOp()) {
-      int lval = stackTop().getStmtVal(left);
+      int lval = this->getNodeVal(leftNode);
       if(opCode == BO_Mul) res = lval * rval;
+      else if(opCode == BO_Div) res = lval / rval;
       else res = lval % rval;
-      stackTop().bindStmt(bop, res);
+      this->bindNode(node, res);
     } else if (bop->isComparisonOp()) {
-      int lval = stackTop().getStmtVal(left);
+      int lval = this->getNodeVal(leftNode);
       int val = SCH001;
       switch (opCode) {
       case BO_LT:
@@ -317,7 +643,7 @@ public:
         break;
       }
       // llvm::outs() << "op: " << op << "val " << val << "\n";
-      stackTop().bindStmt(bop, val);
+      this->bindNode(node, val);
     }
 
     else {
@@ -326,10 +652,12 @@ public:
     }
   }
 
-  void parm(ParmVarDecl *parmdecl, int val) { stackTop().bindDecl(parmdecl, val); }
+  void parm(ParmVarDecl *parmdecl, int val) {
+    stackTop().setSlot(mResolver.getSlot(parmdecl).mIndex, val);
+  }
 
-  /// use by global & local
-  void handleVarDecl(VarDecl * vardecl) {
+  /// use by global & local; \p initNode is the number of the initializer
+  void handleVarDecl(VarDecl * vardecl, unsigned initNode) {
     auto typeInfo = vardecl->getType();
     if(typeInfo->isArrayType()) {
       // array type
@@ -338,52 +666,66 @@ public:
       auto carrayType = dyn_cast<const ConstantArrayType>(arrayType);
       int sz = carrayType->getSize().getSExtValue();
       assert(sz > 0);
-      llvm::outs() << "Init a array with size=" << carrayType->getSize() << "\n";
-      mArrays.emplace_back(sz, mStack.size());
-      stackTop().bindDecl(vardecl, mArrays.size()-1);
+      /// its zeroed storage came with the frame
+      ASTI_TRACE(TL_Trace, "Init a array with size=" << sz << "\n");
+      return;
     }
     int val = 0;
     Expr *expr = vardecl->getInit();
-    if (expr != NULL) { 
+    const FrameLayout &layout = stackTop().getLayout();
+    if (const int *folded = expr ? layout.constant(initNode) : nullptr) {
+      val = *folded;
+    } else if (expr != NULL) { 
       // if(IntegerLiteral *pi = dyn_cast<IntegerLiteral>(expr))
       //   val = pi->getValue().getSExtValue();
       // else {
+        mCurrentNode = initNode;
         mInterpreter->Visit(expr);
-        val = stackTop().getStmtVal(expr);
+        val = this->getNodeVal(initNode);
       // }
     }
-    stackTop().bindDecl(vardecl, val);
+    setDeclVal(vardecl, val);
+  }
+
+  /// like bindVar, but used when a declaration is (re-)initialized
+  void setDeclVal(VarDecl *vardecl, int val) {
+    VarSlot slot = mResolver.getSlot(vardecl);
+    if (slot.mInMemory)
+      store(varAddr(slot), vardecl->getType(), val);
+    else
+      frameOf(slot).setSlot(slot.mIndex, val);
   }
 
-  void decl(DeclStmt *declstmt) {
+  /// the initializers are the children of \p declstmt, numbered \p node
+  void decl(DeclStmt *declstmt, unsigned node) {
+    const FrameLayout &layout = stackTop().getLayout();
     for (DeclStmt::decl_iterator it = declstmt->decl_begin(),
                                  ie = declstmt->decl_end();
          it != ie; ++it) {
       Decl *decl = *it;
       if (VarDecl *vardecl = dyn_cast<VarDecl>(decl)) {
-        handleVarDecl(vardecl);
+        Expr *init = vardecl->getInit();
+        handleVarDecl(vardecl,
+                      init ? layout.childOf(declstmt, node, init) : 0);
         // llvm::outs() << "opaque data: " << vardecl->getTypeSourceInfo()->getTypeLoc().getOpaqueData() << "\n";
       }
     }
   }
 
-  Array& getArray(ArraySubscriptExpr * arrsubexpr) {
-    int arrayID = stackTop().getStmtVal(arrsubexpr->getBase());
-    assert(arrayID < mArrays.size());
-    return mArrays[arrayID];
-  }
-
-  int getArrayIdx(ArraySubscriptExpr * arrsubexpr) {
-    return stackTop().getStmtVal(arrsubexpr->getIdx());
+  /// &base[idx] of \p arrsubexpr numbered \p node, the operands are already
+  /// evaluated; `i[a]` has the base on the right
+  Memory::Addr elementAddr(ArraySubscriptExpr *arrsubexpr, unsigned node) {
+    unsigned lhs = node + 1;
+    unsigned rhs = stackTop().getLayout().next(lhs);
+    bool baseLeft = arrsubexpr->getBase() == arrsubexpr->getLHS();
+    int base = this->getNodeVal(baseLeft ? lhs : rhs);
+    int idx = this->getNodeVal(baseLeft ? rhs : lhs);
+    return base + idx * typeSize(arrsubexpr->getType());
   }
 
-  void arraysub(ArraySubscriptExpr * arrsubexpr) {
-    // llvm::outs() << "getBase() " << arrsubexpr->getBase() << "\n";
-    auto& arr = getArray(arrsubexpr);
-    int idx = getArrayIdx(arrsubexpr);
-    int res = arr.get(idx);
-    // llvm::outs() << "arr[" << idx << "]-> " << res << "\n";
-    stackTop().bindStmt(arrsubexpr, res);
+  void arraysub(ArraySubscriptExpr * arrsubexpr, unsigned node) {
+    int res = load(elementAddr(arrsubexpr, node), arrsubexpr->getType());
+    this->bindNode(node, res);
   }
 
   static bool isValidDeclRefType(DeclRefExpr *declref) {
@@ -391,86 +733,220 @@ public:
     return tp->isIntegerType() || tp->isArrayType() || tp->isPointerType();
   }
 
-  bool isBuiltInDecl(DeclRefExpr *declref) {
-    const Decl * decl = declref->getReferencedDeclOfCallee();
-    return declref->getType()->isFunctionType() &&
-    (decl == mInput || decl == mOutput || decl == mMalloc || decl == mFree);
-  }
-
-  void declref(DeclRefExpr *declref) {
+  void declref(DeclRefExpr *declref, unsigned node) {
     stackTop().setPC(declref);
     if (isValidDeclRefType(declref)) {
       // declref->dump();
-      Decl *decl = declref->getFoundDecl();
-
-      int val = this->getDeclVal(decl);
-      stackTop().bindStmt(declref, val);
-    } else if(!isBuiltInDecl(declref) && !declref->getType()->isFunctionType()){
+      int val =
+          this->getVarVal(refSlot(node), declref->getDecl()->getType());
+      this->bindNode(node, val);
+    } else if (!declref->getType()->isFunctionType()) {
+      /// callees are resolved by the BuiltinRegistry, not evaluated
       llvm::outs() << "Below declref is not supported:\n";
       declref->dump();
     }
   }
 
-  void cast(CastExpr *castexpr) {
+  void cast(CastExpr *castexpr, unsigned node) {
     stackTop().setPC(castexpr);
     if (castexpr->getType()->isIntegerType()) {
-      Expr *expr = castexpr->getSubExpr();
-      int val = stackTop().getStmtVal(expr);
-      stackTop().bindStmt(castexpr, val);
+      int val = this->getNodeVal(node + 1);
+      this->bindNode(node, val);
     }
   }
 
+  BuiltinRegistry &getBuiltins() { return mBuiltins; }
+
+  /// what a call to \p callee does, resolved once by init()
+  const CallTarget &getCallTarget(const FunctionDecl *callee) const {
+    return mBuiltins.lookup(callee);
+  }
+
+  /// The built-in functions, shared by every execution engine
+  int builtinGet() {
+    mSideEffects = true;
+    return mIO.get();
+  }
+  void builtinPrint(int val) {
+    mSideEffects = true;
+    mIO.print(val);
+  }
+  int builtinMalloc(int size) { return mHeap.Malloc(size); }
+  void builtinFree(int addr) { mHeap.Free(addr); }
+  int callNative(unsigned idx, const int *args) {
+    mSideEffects = true;
+    return mBuiltins.callNative(idx, args, mMemory.data());
+  }
+
+  [[noreturn]] void noBody(const FunctionDecl *callee) {
+    llvm::outs() << "function " << callee->getName()
+                 << " has no body, is a --native library missing?\n";
+    throw std::exception();
+  }
+
+  /// the number of the first argument of a call numbered \p node, the
+  /// callee is the first child; the next ones follow with
+  /// FrameLayout::next()
+  unsigned firstArg(unsigned node) {
+    return stackTop().getLayout().next(node + 1);
+  }
+
   /// !TODO Support Function Call
-  bool call(CallExpr *callexpr) {
+  bool call(CallExpr *callexpr, unsigned node) {
     bool notBuiltin = false;
     stackTop().setPC(callexpr);
     int val = 0;
     FunctionDecl *callee = callexpr->getDirectCallee();
-    if (callee == mInput) {
-      llvm::outs() << "Please Input an Integer Value : ";
-      scanf("%d", &val);
-
-      stackTop().bindStmt(callexpr, val);
-    } else if (callee == mOutput) {
-      Expr *decl = callexpr->getArg(0);
-      val = stackTop().getStmtVal(decl);
-      llvm::errs() << val;
-    } else if (callee == mMalloc) {
-      Expr *decl = callexpr->getArg(0);
-      val = stackTop().getStmtVal(decl); /// malloc size
-      int addr = mHeap.Malloc(val); /// our "address"
-      stackTop().bindStmt(callexpr, addr);
-    } else if (callee == mFree) {
-      Expr *decl = callexpr->getArg(0);
-      val = stackTop().getStmtVal(decl); /// address waited to free
-      mHeap.Free(val);
-    } else {
+    const CallTarget &target = getCallTarget(callee);
+    const FrameLayout &layout = stackTop().getLayout();
+    unsigned arg = firstArg(node);
+    switch (target.mKind) {
+    case BK_Get:
+      this->bindNode(node, builtinGet());
+      break;
+    case BK_Print:
+      builtinPrint(this->getNodeVal(arg));
+      break;
+    case BK_Malloc:
+      val = this->getNodeVal(arg); /// malloc size
+      this->bindNode(node, builtinMalloc(val));
+      break;
+    case BK_Free:
+      val = this->getNodeVal(arg); /// address waited to free
+      builtinFree(val);
+      break;
+    case BK_Native: {
+      int args[BuiltinRegistry::MAX_NATIVE_PARAMS];
+      /// the registry only accepts fixed prototypes with that many
+      /// parameters, which Sema matched the arguments against
+      for (unsigned i = 0, e = callexpr->getNumArgs();
+           i != e && i != BuiltinRegistry::MAX_NATIVE_PARAMS;
+           i++, arg = layout.next(arg))
+        args[i] = this->getNodeVal(arg);
+      this->bindNode(node, callNative(target.mNative, args));
+      break;
+    }
+    case BK_None: {
       // llvm::outs() << "function call\n";
       notBuiltin = true;
-      /// first we get the arguments from caller frame
-      std::vector<int> args;
-      Expr ** exprList = callexpr->getArgs();
-      for(int i=0; i<callexpr->getNumArgs(); i++) {
-        int val = stackTop().getStmtVal(exprList[i]);
-        args.push_back(val);
-      }
       /// You could add your code here for Function call Return
-      mStack.push_back(StackFrame()); // push frame
-      // define parameter list
+      callee = target.mDefinition;
+      if (!callee)
+        noBody(callexpr->getDirectCallee());
       assert(callee->getNumParams() == callexpr->getNumArgs());
-      for (int i = 0; i < callee->getNumParams(); i++) {
-        this->parm(callee->getParamDecl(i), args[i]);
+      /// the caller's temps stay put in the arena while the callee frame is
+      /// pushed, so the arguments go straight into the parameter slots
+      int *callerTemps = stackTop().tempData();
+      stackPush(callee); // push frame
+      StackFrame &frame = stackTop();
+      /// parameters are the first slots of a frame
+      for (unsigned i = 0, e = callexpr->getNumArgs(); i != e;
+           i++, arg = layout.next(arg)) {
+        assert(mResolver.getSlot(callee->getParamDecl(i)).mIndex == i);
+        frame.setSlot(i, callerTemps[arg]);
       }
-      int retVal = 0;
-      stackTop().setPC(callee->getBody());
+      enterBody(callee);
+      break;
+    }
     }
     return notBuiltin;
   }
 
-  void retrn(ReturnStmt *retstmt) {
+  /// the callee of \p call numbered \p node, whose arguments are
+  /// evaluated, and the values of the arguments if its calls are memoized;
+  /// null otherwise
+  const FunctionDecl *memoCallee(CallExpr *call, unsigned node, int *args) {
+    if (!mMemo || !call->getDirectCallee())
+      return nullptr;
+    const FunctionDecl *callee =
+        getCallTarget(call->getDirectCallee()).mDefinition;
+    if (!callee || !mPurity.isPure(callee))
+      return nullptr;
+    const FrameLayout &layout = stackTop().getLayout();
+    unsigned arg = firstArg(node);
+    for (unsigned i = 0, e = call->getNumArgs(); i != e;
+         i++, arg = layout.next(arg))
+      args[i] = this->getNodeVal(arg);
+    return callee;
+  }
+  /// the result of \p call if it is memoized and was computed before
+  bool memoLookup(CallExpr *call, unsigned node, int &retVal) {
+    int args[MemoCache::MAX_ARGS];
+    const FunctionDecl *callee = memoCallee(call, node, args);
+    return callee && mMemo->lookup(callee, args, call->getNumArgs(), retVal);
+  }
+  /// remember \p retVal as the result of \p call if it is memoized
+  void memoStore(CallExpr *call, unsigned node, int retVal) {
+    int args[MemoCache::MAX_ARGS];
+    if (const FunctionDecl *callee = memoCallee(call, node, args))
+      mMemo->store(callee, args, call->getNumArgs(), retVal);
+  }
+
+  /// \p retstmt runs as a tail call: the Resolver marked it, and calls to
+  /// its callee are not memoized, whose results are stored when they return
+  bool isTailCall(ReturnStmt *retstmt) {
+    if (!mResolver.isTailCall(retstmt))
+      return false;
+    if (!mMemo)
+      return true;
+    const FunctionDecl *callee =
+        getCallTarget(Resolver::callOf(retstmt)->getDirectCallee())
+            .mDefinition;
+    return !callee || !mPurity.isPure(callee);
+  }
+
+  /// the parameters are bound, start \p callee on top of the stack
+  void enterBody(FunctionDecl *callee) {
+    if (mResolver.getLayout(callee).mSpillParams)
+      spillParams(callee);
+    stackTop().setPC(callee->getBody());
+  }
+
+  /// `return callee(args)` marked by the Resolver as a tail call: the frame
+  /// of the callee replaces the current one, whose arguments are evaluated;
+  /// \p node is the number of the call
+  void tailCall(CallExpr *callexpr, unsigned node) {
+    stackTop().setPC(callexpr);
+    /// the same target Environment::call and the bytecode compiler use
+    FunctionDecl *callee =
+        getCallTarget(callexpr->getDirectCallee()).mDefinition;
+    if (!callee)
+      noBody(callexpr->getDirectCallee());
+    assert(callee->getNumParams() == callexpr->getNumArgs());
+    mTailArgs.clear();
+    const FrameLayout &layout = stackTop().getLayout();
+    unsigned arg = firstArg(node);
+    for (unsigned i = 0, e = callexpr->getNumArgs(); i != e;
+         i++, arg = layout.next(arg))
+      mTailArgs.push_back(this->getNodeVal(arg));
+    stackPop();
+    stackPush(callee);
+    StackFrame &frame = stackTop();
+    for (unsigned i = 0; i < mTailArgs.size(); i++)
+      frame.setSlot(i, mTailArgs[i]);
+    enterBody(callee);
+  }
+
+  /// copy the parameters that live in Memory from their slots
+  void spillParams(FunctionDecl *callee) {
+    for (unsigned i = 0; i < callee->getNumParams(); i++) {
+      ParmVarDecl *param = callee->getParamDecl(i);
+      VarSlot slot = mResolver.getSlot(param);
+      if (slot.mInMemory)
+        store(varAddr(slot), param->getType(), stackTop().getSlot(i));
+    }
+  }
+
+  /// record the return value, the visitor unwinds to the call with CK_Return
+  void retrn(ReturnStmt *retstmt, unsigned node) {
     stackTop().setPC(retstmt);
-    int val = stackTop().getStmtVal(retstmt->getRetValue());
-    // llvm::outs() << "return val: " << val << "\n";
-    throw ReturnException(val);
+    Expr *value = retstmt->getRetValue();
+    mRetVal = value ? this->getNodeVal(node + 1) : 0;
   }
+  int getRetVal() { return mRetVal; }
+  /// a return whose value was computed elsewhere, e.g. by the bytecode
+  /// engine after a tier-up
+  void setRetVal(int val) { mRetVal = val; }
 };
+
+#endif
@@ -0,0 +1,72 @@
+//==--- FrameArena.h - Contiguous storage of the interpreter frames --------==//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_FRAMEARENA_H
+#define AST_INTERPRETER_FRAMEARENA_H
+
+#include <cassert>
+#include <cstring>
+#include <exception>
+#include <sys/mman.h>
+
+#include "llvm/Support/raw_ostream.h"
+
+/// The storage of all frames: a stack of ints in one virtual reservation.
+/// A call bump-allocates its frame and the return releases it again, so a
+/// call does no heap allocation. Pages are committed as the stack first grows
+/// into them, and nothing ever moves, so frames can hand out raw pointers.
+class FrameArena {
+public:
+  static const size_t DEFAULT_BUDGET = size_t(256) << 20;
+
+private:
+  static const size_t COMMIT_CHUNK = size_t(1) << 20;
+
+  int *mBase;
+  /// size of the reservation, the most the frames may ever use
+  size_t mBudget;
+  size_t mCommitted;
+  /// ints in use
+  size_t mTop;
+
+public:
+  explicit FrameArena(size_t budget = DEFAULT_BUDGET)
+      : mBase(nullptr), mBudget(budget), mCommitted(0), mTop(0) {
+    void *ptr = mmap(nullptr, mBudget, PROT_NONE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    assert(ptr != MAP_FAILED && "cannot reserve the frame arena");
+    mBase = (int *)ptr;
+  }
+  ~FrameArena() { munmap(mBase, mBudget); }
+  FrameArena(const FrameArena &) = delete;
+  FrameArena &operator=(const FrameArena &) = delete;
+
+  /// a zeroed frame of \p size ints
+  int *push(size_t size) {
+    size_t bytes = (mTop + size) * sizeof(int);
+    if (bytes > mCommitted) {
+      size_t commit = (bytes + COMMIT_CHUNK - 1) / COMMIT_CHUNK * COMMIT_CHUNK;
+      if (commit > mBudget)
+        commit = mBudget;
+      if (bytes > commit ||
+          mprotect((char *)mBase + mCommitted, commit - mCommitted,
+                   PROT_READ | PROT_WRITE) != 0) {
+        llvm::errs() << "interpreter stack overflow (" << (mBudget >> 20)
+                     << " MB), raise it with --stack-size\n";
+        throw std::exception();
+      }
+      mCommitted = commit;
+    }
+    int *frame = mBase + mTop;
+    memset(frame, 0, size * sizeof(int));
+    mTop += size;
+    return frame;
+  }
+
+  /// release \p frame and every frame pushed after it
+  void pop(int *frame) {
+    assert(frame >= mBase && frame <= mBase + mTop);
+    mTop = frame - mBase;
+  }
+};
+
+#endif
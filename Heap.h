@@ -0,0 +1,201 @@
+//==--- Heap.h - Heap of the interpreted program ----------------------------==//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_HEAP_H
+#define AST_INTERPRETER_HEAP_H
+
+#include <algorithm>
+#include <cassert>
+#include <exception>
+#include <map>
+#include <vector>
+
+#include "llvm/ADT/StringRef.h"
+
+#include "Memory.h"
+#include "Trace.h"
+
+/// Heap hands out the MALLOC/FREE blocks of the heap segment of Memory
+///
+/// Addresses are ordinary Memory addresses. Pages are only committed when the
+/// heap grows into them, so the heap can grow to hundreds of MB without ever
+/// copying.
+///
+/// Every block starts with a header holding its size. Blocks up to
+/// SMALL_LIMIT bytes are recycled through one free list per size class, which
+/// makes MALLOC/FREE O(1) for them. Bigger free blocks are kept ordered by
+/// address and coalesced with their free neighbours.
+class Heap {
+public:
+  typedef Memory::Addr HeapAddr;
+private:
+  static const int ALIGN = Memory::ALIGN;
+  static const int HEADER_SIZE = 8;
+  static const int SMALL_LIMIT = 512;
+  static const int NUM_CLASSES = (SMALL_LIMIT + HEADER_SIZE) / ALIGN + 1;
+
+  Memory &mMemory;
+  char *mHeapPtr;
+  Memory::Segment mSegment;
+  /// everything from here on has never been handed out
+  HeapAddr mTop;
+  /// heads of the free lists of small blocks by size class, 0 if empty.
+  /// The next pointer is kept in the first word of a free block's payload.
+  HeapAddr mSmallFree[NUM_CLASSES];
+  /// free large blocks: block address -> block size
+  std::map<HeapAddr, int> mLargeFree;
+
+  /// blocks are addressed by their header, users get the payload after it
+  int &blockSize(HeapAddr block) { return *(int *)(mHeapPtr + block); }
+
+  static int sizeClass(int blockSz) { return blockSz / ALIGN; }
+
+  void outOfMemory(int size) {
+    llvm::errs() << "heap exhausted allocating " << size << " bytes\n";
+    throw std::exception();
+  }
+
+  /// carve a fresh block from the top, committing pages on demand
+  HeapAddr grow(int blockSz) {
+    size_t newTop = (size_t)mTop + blockSz;
+    if (!mMemory.reach(mSegment, newTop))
+      outOfMemory(blockSz);
+    HeapAddr block = mTop;
+    mTop = newTop;
+    blockSize(block) = blockSz;
+    return block;
+  }
+
+  /// first fit among the large free blocks, splitting off the rest
+  HeapAddr takeLarge(int blockSz) {
+    for (auto it = mLargeFree.begin(); it != mLargeFree.end(); ++it) {
+      if (it->second < blockSz)
+        continue;
+      HeapAddr block = it->first;
+      int rest = it->second - blockSz;
+      mLargeFree.erase(it);
+      if (rest >= HEADER_SIZE + ALIGN) {
+        blockSize(block + blockSz) = rest;
+        release(block + blockSz);
+      } else {
+        blockSz += rest;
+      }
+      blockSize(block) = blockSz;
+      return block;
+    }
+    return 0;
+  }
+
+  void release(HeapAddr block) {
+    int blockSz = blockSize(block);
+    if (blockSz <= SMALL_LIMIT + HEADER_SIZE) {
+      int cls = sizeClass(blockSz);
+      *(HeapAddr *)(mHeapPtr + block + HEADER_SIZE) = mSmallFree[cls];
+      mSmallFree[cls] = block;
+      return;
+    }
+    /// coalesce with the following and the preceding free block
+    auto next = mLargeFree.find(block + blockSz);
+    if (next != mLargeFree.end()) {
+      blockSz += next->second;
+      mLargeFree.erase(next);
+    }
+    auto prev = mLargeFree.lower_bound(block);
+    if (prev != mLargeFree.begin()) {
+      --prev;
+      if (prev->first + prev->second == block) {
+        block = prev->first;
+        blockSz += prev->second;
+        mLargeFree.erase(prev);
+      }
+    }
+    /// a free block at the top just gives the space back to the top
+    if (block + blockSz == mTop) {
+      mTop = block;
+      return;
+    }
+    blockSize(block) = blockSz;
+    mLargeFree[block] = blockSz;
+  }
+
+public:
+    explicit Heap(Memory &memory)
+        : mMemory(memory), mHeapPtr(memory.data()),
+          mSegment(Memory::HEAP_BASE, Memory::LIMIT), mTop(Memory::HEAP_BASE),
+          mLargeFree() {
+      for (int i = 0; i < NUM_CLASSES; i++)
+        mSmallFree[i] = 0;
+    }
+    Heap(const Heap &) = delete;
+    Heap &operator=(const Heap &) = delete;
+
+    /// what a Heap needs besides its bytes to carry on where another one
+    /// stopped (Snapshot.h)
+    struct FreeBlock {
+      HeapAddr mBlock;
+      int mSize;
+    };
+    struct State {
+      HeapAddr mTop;
+      std::vector<HeapAddr> mSmallFree;
+      std::vector<FreeBlock> mLargeFree;
+    };
+    State save() const {
+      State state;
+      state.mTop = mTop;
+      state.mSmallFree.assign(mSmallFree, mSmallFree + NUM_CLASSES);
+      for (const auto &free : mLargeFree)
+        state.mLargeFree.push_back(FreeBlock{free.first, free.second});
+      return state;
+    }
+    /// the blocks handed out so far, free or not
+    llvm::StringRef bytes() const {
+      return llvm::StringRef(mHeapPtr + Memory::HEAP_BASE,
+                             mTop - Memory::HEAP_BASE);
+    }
+    /// continue from \p state, with \p bytes as its blocks; false if they
+    /// do not fit this Heap, which is then unchanged
+    bool restore(const State &state, llvm::StringRef bytes) {
+      if (state.mSmallFree.size() != NUM_CLASSES ||
+          state.mTop < Memory::HEAP_BASE ||
+          bytes.size() != (size_t)(state.mTop - Memory::HEAP_BASE) ||
+          !mMemory.reach(mSegment, state.mTop))
+        return false;
+      memcpy(mHeapPtr + Memory::HEAP_BASE, bytes.data(), bytes.size());
+      mTop = state.mTop;
+      std::copy(state.mSmallFree.begin(), state.mSmallFree.end(), mSmallFree);
+      mLargeFree.clear();
+      for (const FreeBlock &free : state.mLargeFree)
+        mLargeFree[free.mBlock] = free.mSize;
+      return true;
+    }
+
+    HeapAddr Malloc(int size) {
+      if (size < (int)sizeof(HeapAddr))
+        size = sizeof(HeapAddr);
+      if (size > Memory::LIMIT - Memory::HEAP_BASE)
+        outOfMemory(size);
+      int blockSz = (size + HEADER_SIZE + ALIGN - 1) / ALIGN * ALIGN;
+      HeapAddr block = 0;
+      if (blockSz <= SMALL_LIMIT + HEADER_SIZE) {
+        int cls = sizeClass(blockSz);
+        if ((block = mSmallFree[cls]) != 0)
+          mSmallFree[cls] = *(HeapAddr *)(mHeapPtr + block + HEADER_SIZE);
+      } else {
+        block = takeLarge(blockSz);
+      }
+      if (!block)
+        block = grow(blockSz);
+      HeapAddr ret = block + HEADER_SIZE;
+      ASTI_TRACE(TL_Trace, "allocate size=" << size << ", return address=" << ret << "\n");
+      return ret;
+    }
+    void Free (HeapAddr addr) {
+      /// FREE(NULL) does nothing
+      if (addr == 0)
+        return;
+      assert(addr >= Memory::HEAP_BASE + HEADER_SIZE && addr < mTop);
+      release(addr - HEADER_SIZE);
+    }
+};
+
+#endif
@@ -0,0 +1,689 @@
+//==--- JIT.h - Native code of the bytecode functions through LLVM ORC -----==//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_JIT_H
+#define AST_INTERPRETER_JIT_H
+
+/// Set by the ASTI_JIT CMake option, which also links the LLVM libraries the
+/// JIT needs; without it `--jit` only prints a warning.
+#ifndef ASTI_JIT
+#define ASTI_JIT 0
+#endif
+
+#if ASTI_JIT
+
+#include <memory>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Transforms/InstCombine/InstCombine.h"
+#include "llvm/Transforms/Scalar.h"
+#include "llvm/Transforms/Scalar/GVN.h"
+#include "llvm/Transforms/Utils.h"
+
+#include "Bytecode.h"
+
+/// What native code reaches through its first argument. The field order is
+/// mirrored by JITLowering::contextType.
+struct JITContext {
+  Environment *mEnv;
+  /// Memory::data()
+  char *mMemory;
+  /// slots of the global frame
+  int *mGlobals;
+  /// a call whose frame would start below this reports a stack overflow
+  char *mStackLimit;
+};
+
+/// The ABI of every compiled function, whether it is called by the bytecode
+/// engine or by other native code: the context and the arguments, one int
+/// each, like the register window the bytecode engine passes.
+typedef int (*JITFunction)(JITContext *ctx, const int *args);
+
+/// Lowers the bytecode of one function to LLVM IR with the JITFunction ABI.
+/// Every register is an alloca, which mem2reg turns back into SSA values, and
+/// every branch target of the bytecode starts a basic block. The builtins,
+/// native functions and the frame Memory go through the helpers of JIT.
+class JITLowering {
+  Environment &mEnv;
+  BytecodeModule &mModule;
+  unsigned mIdx;
+  BCFunction &mFn;
+  llvm::Module &mIR;
+  llvm::LLVMContext &mContext;
+  llvm::IRBuilder<> mBuilder;
+
+  llvm::Function *mFunction;
+  llvm::Value *mCtx;
+  llvm::Value *mMemory;
+  llvm::Value *mGlobals;
+  /// Memory of the frame, 0 if it has none
+  llvm::Value *mMem;
+  std::vector<llvm::AllocaInst *> mRegs;
+  /// arguments of the calls
+  llvm::AllocaInst *mArgv;
+  /// where a self tail call continues
+  llvm::BasicBlock *mStart;
+  /// the block starting at each instruction, null inside a block
+  std::vector<llvm::BasicBlock *> mBlocks;
+
+  llvm::Type *intType() { return mBuilder.getInt32Ty(); }
+  llvm::Type *bytePtrType() { return mBuilder.getInt8PtrTy(); }
+
+  llvm::Value *get(int reg) {
+    return mBuilder.CreateLoad(intType(), mRegs[reg]);
+  }
+  void set(int reg, llvm::Value *val) { mBuilder.CreateStore(val, mRegs[reg]); }
+  llvm::Value *imm(int val) { return mBuilder.getInt32(val); }
+
+  llvm::Value *contextField(unsigned field, llvm::Type *type,
+                            const char *name) {
+    return mBuilder.CreateLoad(
+        type, mBuilder.CreateStructGEP(contextType(mContext), mCtx, field),
+        name);
+  }
+
+  llvm::FunctionCallee helper(const char *name, llvm::Type *ret,
+                              llvm::ArrayRef<llvm::Type *> params) {
+    return mIR.getOrInsertFunction(
+        name, llvm::FunctionType::get(ret, params, false));
+  }
+
+  /// a pointer to the \p size byte int at Memory address \p addr
+  llvm::Value *memoryPtr(llvm::Value *addr, int size) {
+    llvm::Value *ptr = mBuilder.CreateInBoundsGEP(
+        mBuilder.getInt8Ty(), mMemory,
+        mBuilder.CreateSExt(addr, mBuilder.getInt64Ty()));
+    return mBuilder.CreateBitCast(
+        ptr, llvm::PointerType::getUnqual(mBuilder.getIntNTy(size * 8)));
+  }
+  /// like Memory::load, addresses need not be aligned
+  llvm::Value *load(llvm::Value *addr, int size, bool isSigned) {
+    llvm::Type *type = mBuilder.getIntNTy(size * 8);
+    llvm::Value *val = mBuilder.CreateAlignedLoad(type, memoryPtr(addr, size),
+                                                  llvm::MaybeAlign(1));
+    if (size == sizeof(int))
+      return val;
+    return isSigned ? mBuilder.CreateSExt(val, intType())
+                    : mBuilder.CreateZExt(val, intType());
+  }
+  void store(llvm::Value *addr, llvm::Value *val, int size) {
+    if (size != sizeof(int))
+      val = mBuilder.CreateTrunc(val, mBuilder.getIntNTy(size * 8));
+    mBuilder.CreateAlignedStore(val, memoryPtr(addr, size),
+                                llvm::MaybeAlign(1));
+  }
+  /// `base + idx * sizeof(int)`, the address ArrLoad and ArrStore use
+  llvm::Value *element(int base, int idx) {
+    return mBuilder.CreateAdd(
+        get(base), mBuilder.CreateMul(get(idx), imm(sizeof(int))));
+  }
+
+  llvm::Value *global(int slot) {
+    return mBuilder.CreateInBoundsGEP(intType(), mGlobals, imm(slot));
+  }
+
+  llvm::Value *compare(llvm::CmpInst::Predicate pred, int lhs, int rhs) {
+    return mBuilder.CreateICmp(pred, get(lhs), get(rhs));
+  }
+  void branch(llvm::Value *cond, int target, size_t next) {
+    mBuilder.CreateCondBr(cond, mBlocks[target], mBlocks[next]);
+  }
+
+  /// copy the \p count registers from \p first on to mArgv
+  llvm::Value *passArgs(int first, unsigned count) {
+    for (unsigned i = 0; i < count; i++)
+      mBuilder.CreateStore(get(first + i), mBuilder.CreateConstInBoundsGEP2_32(
+                                               mArgv->getAllocatedType(),
+                                               mArgv, 0, i));
+    return mBuilder.CreateConstInBoundsGEP2_32(mArgv->getAllocatedType(),
+                                               mArgv, 0, 0);
+  }
+  llvm::Value *call(unsigned callee, int firstArg) {
+    llvm::Value *args = passArgs(firstArg, mModule.get(callee).mNumParams);
+    return mBuilder.CreateCall(
+        mIR.getOrInsertFunction(symbolName(mModule, callee),
+                                functionType(mContext)),
+        {mCtx, args});
+  }
+
+  /// release the Memory of the frame, like the Ret of the bytecode engine
+  void leaveFrame() {
+    if (mFn.mMemSize)
+      mBuilder.CreateCall(helper("asti_jit_leave", mBuilder.getVoidTy(),
+                                 {mCtx->getType(), intType()}),
+                          {mCtx, mMem});
+  }
+
+  /// operands of Call, TailCall and Native
+  unsigned maxArgs() {
+    unsigned max = 1;
+    for (const Instr &instr : mFn.mCode) {
+      unsigned count = 0;
+      if (instr.mOp == OP_Call || instr.mOp == OP_TailCall)
+        count = mModule.get(instr.mB).mNumParams;
+      else if (instr.mOp == OP_Native)
+        count = mEnv.getBuiltins().getNative(instr.mB).mNumParams;
+      if (count > max)
+        max = count;
+    }
+    return max;
+  }
+
+  /// the instruction a branch jumps to, -1 if \p instr is no branch
+  static int branchTarget(const Instr &instr) {
+    switch (instr.mOp) {
+    case OP_Jump: return instr.mA;
+    case OP_JumpIf:
+    case OP_JumpIfNot: return instr.mB;
+    case OP_JumpLt:
+    case OP_JumpGt:
+    case OP_JumpLe:
+    case OP_JumpGe:
+    case OP_JumpEq:
+    case OP_JumpNe: return instr.mC;
+    default: return -1;
+    }
+  }
+
+  void createBlocks() {
+    const std::vector<Instr> &code = mFn.mCode;
+    mBlocks.assign(code.size() + 1, nullptr);
+    std::vector<bool> leader(code.size() + 1, false);
+    leader[0] = true;
+    for (size_t i = 0; i < code.size(); i++) {
+      int target = branchTarget(code[i]);
+      if (target >= 0)
+        leader[target] = true;
+      if (target >= 0 || code[i].mOp == OP_Ret || code[i].mOp == OP_TailCall)
+        leader[i + 1] = true;
+    }
+    for (size_t i = 0; i < leader.size(); i++)
+      if (leader[i])
+        mBlocks[i] =
+            llvm::BasicBlock::Create(mContext, "bc" + llvm::Twine(i), mFunction);
+  }
+
+  /// Allocas, the stack check, the arguments and the frame. A self tail
+  /// call stores its arguments and jumps back to mStart.
+  void lowerPrologue(llvm::Value *args) {
+    llvm::BasicBlock *entry =
+        llvm::BasicBlock::Create(mContext, "entry", mFunction);
+    mBuilder.SetInsertPoint(entry);
+    for (unsigned i = 0; i < mFn.mNumRegs; i++)
+      mRegs.push_back(
+          mBuilder.CreateAlloca(intType(), nullptr, "r" + llvm::Twine(i)));
+    mArgv = mBuilder.CreateAlloca(llvm::ArrayType::get(intType(), maxArgs()),
+                                  nullptr, "argv");
+    llvm::Value *probe =
+        mBuilder.CreateAlloca(mBuilder.getInt8Ty(), nullptr, "probe");
+    mMemory = contextField(1, bytePtrType(), "memory");
+    mGlobals = contextField(2, llvm::PointerType::getUnqual(intType()),
+                            "globals");
+
+    /// the native stack is bounded while the bytecode engine's frames are
+    /// not, so deep recursion has to fail like it would there
+    llvm::Value *limit = contextField(3, bytePtrType(), "limit");
+    llvm::Value *inBounds = mBuilder.CreateICmpUGT(
+        mBuilder.CreatePtrToInt(probe, mBuilder.getInt64Ty()),
+        mBuilder.CreatePtrToInt(limit, mBuilder.getInt64Ty()));
+    llvm::BasicBlock *overflow =
+        llvm::BasicBlock::Create(mContext, "overflow", mFunction);
+    llvm::BasicBlock *params =
+        llvm::BasicBlock::Create(mContext, "params", mFunction);
+    mBuilder.CreateCondBr(inBounds, params, overflow);
+    mBuilder.SetInsertPoint(overflow);
+    mBuilder.CreateCall(
+        helper("asti_jit_overflow", mBuilder.getVoidTy(), {mCtx->getType()}),
+        {mCtx});
+    mBuilder.CreateUnreachable();
+
+    mBuilder.SetInsertPoint(params);
+    for (unsigned i = 0; i < mFn.mNumParams; i++)
+      set(i, mBuilder.CreateLoad(
+                 intType(),
+                 mBuilder.CreateConstInBoundsGEP1_32(intType(), args, i)));
+    mStart = llvm::BasicBlock::Create(mContext, "start", mFunction);
+    mBuilder.CreateBr(mStart);
+
+    /// the bytecode engine starts every call with a zeroed window
+    mBuilder.SetInsertPoint(mStart);
+    for (unsigned i = mFn.mNumParams; i < mFn.mNumRegs; i++)
+      set(i, imm(0));
+    mMem = mFn.mMemSize
+               ? (llvm::Value *)mBuilder.CreateCall(
+                     helper("asti_jit_enter", intType(),
+                            {mCtx->getType(), intType()}),
+                     {mCtx, imm(mFn.mMemSize)}, "mem")
+               : imm(0);
+  }
+
+  void lowerInstr(const Instr &instr, size_t at) {
+    using llvm::CmpInst;
+    switch (instr.mOp) {
+    case OP_LoadImm: set(instr.mA, imm(instr.mB)); break;
+    case OP_Move: set(instr.mA, get(instr.mB)); break;
+    case OP_LoadGlobal:
+      set(instr.mA, mBuilder.CreateLoad(intType(), global(instr.mB)));
+      break;
+    case OP_StoreGlobal:
+      mBuilder.CreateStore(get(instr.mB), global(instr.mA));
+      break;
+    case OP_Add:
+      set(instr.mA, mBuilder.CreateAdd(get(instr.mB), get(instr.mC)));
+      break;
+    case OP_Sub:
+      set(instr.mA, mBuilder.CreateSub(get(instr.mB), get(instr.mC)));
+      break;
+    case OP_Mul:
+      set(instr.mA, mBuilder.CreateMul(get(instr.mB), get(instr.mC)));
+      break;
+    case OP_Div:
+      set(instr.mA, mBuilder.CreateSDiv(get(instr.mB), get(instr.mC)));
+      break;
+    case OP_Rem:
+      set(instr.mA, mBuilder.CreateSRem(get(instr.mB), get(instr.mC)));
+      break;
+    case OP_Lt:
+    case OP_Gt:
+    case OP_Le:
+    case OP_Ge:
+    case OP_Eq:
+    case OP_Ne: {
+      static const CmpInst::Predicate preds[] = {
+          CmpInst::ICMP_SLT, CmpInst::ICMP_SGT, CmpInst::ICMP_SLE,
+          CmpInst::ICMP_SGE, CmpInst::ICMP_EQ,  CmpInst::ICMP_NE};
+      set(instr.mA,
+          mBuilder.CreateZExt(
+              compare(preds[instr.mOp - OP_Lt], instr.mB, instr.mC),
+              intType()));
+      break;
+    }
+    case OP_AddImm:
+      set(instr.mA, mBuilder.CreateAdd(get(instr.mB), imm(instr.mC)));
+      break;
+    case OP_MulImm:
+      set(instr.mA, mBuilder.CreateMul(get(instr.mB), imm(instr.mC)));
+      break;
+    case OP_DivImm:
+      set(instr.mA, mBuilder.CreateSDiv(get(instr.mB), imm(instr.mC)));
+      break;
+    case OP_Neg: set(instr.mA, mBuilder.CreateNeg(get(instr.mB))); break;
+    case OP_Not: set(instr.mA, mBuilder.CreateNot(get(instr.mB))); break;
+    case OP_LNot:
+      set(instr.mA, mBuilder.CreateZExt(
+                        mBuilder.CreateICmpEQ(get(instr.mB), imm(0)),
+                        intType()));
+      break;
+    case OP_FrameAddr:
+      set(instr.mA, mBuilder.CreateAdd(mMem, imm(instr.mB)));
+      break;
+    case OP_Load: set(instr.mA, load(get(instr.mB), sizeof(int), true)); break;
+    case OP_Store: store(get(instr.mA), get(instr.mB), sizeof(int)); break;
+    case OP_LoadN:
+      set(instr.mA, load(get(instr.mB), instr.mC < 0 ? -instr.mC : instr.mC,
+                         instr.mC < 0));
+      break;
+    case OP_StoreN: store(get(instr.mA), get(instr.mB), instr.mC); break;
+    case OP_ArrLoad:
+      set(instr.mA, load(element(instr.mB, instr.mC), sizeof(int), true));
+      break;
+    case OP_ArrStore:
+      store(element(instr.mA, instr.mB), get(instr.mC), sizeof(int));
+      break;
+    case OP_Jump: mBuilder.CreateBr(mBlocks[instr.mA]); break;
+    /// the loop that follows is native code already
+    case OP_Idiom: break;
+    case OP_JumpIf:
+      branch(mBuilder.CreateICmpNE(get(instr.mA), imm(0)), instr.mB, at + 1);
+      break;
+    case OP_JumpIfNot:
+      branch(mBuilder.CreateICmpEQ(get(instr.mA), imm(0)), instr.mB, at + 1);
+      break;
+    case OP_JumpLt:
+    case OP_JumpGt:
+    case OP_JumpLe:
+    case OP_JumpGe:
+    case OP_JumpEq:
+    case OP_JumpNe: {
+      static const CmpInst::Predicate preds[] = {
+          CmpInst::ICMP_SLT, CmpInst::ICMP_SGT, CmpInst::ICMP_SLE,
+          CmpInst::ICMP_SGE, CmpInst::ICMP_EQ,  CmpInst::ICMP_NE};
+      branch(compare(preds[instr.mOp - OP_JumpLt], instr.mA, instr.mB),
+             instr.mC, at + 1);
+      break;
+    }
+    case OP_Call: set(instr.mA, call(instr.mB, instr.mC)); break;
+    case OP_TailCall:
+      if ((unsigned)instr.mB == mIdx) {
+        /// tail recursion becomes a loop, so it runs in constant stack
+        /// like it does in the bytecode engine
+        std::vector<llvm::Value *> args;
+        for (unsigned i = 0; i < mFn.mNumParams; i++)
+          args.push_back(get(instr.mC + i));
+        leaveFrame();
+        for (unsigned i = 0; i < mFn.mNumParams; i++)
+          set(i, args[i]);
+        mBuilder.CreateBr(mStart);
+      } else {
+        leaveFrame();
+        mBuilder.CreateRet(call(instr.mB, instr.mC));
+      }
+      break;
+    case OP_Ret: {
+      llvm::Value *ret = get(instr.mA);
+      leaveFrame();
+      mBuilder.CreateRet(ret);
+      break;
+    }
+    case OP_Get:
+      set(instr.mA,
+          mBuilder.CreateCall(
+              helper("asti_jit_get", intType(), {mCtx->getType()}), {mCtx}));
+      break;
+    case OP_Print:
+      mBuilder.CreateCall(helper("asti_jit_print", mBuilder.getVoidTy(),
+                                 {mCtx->getType(), intType()}),
+                          {mCtx, get(instr.mA)});
+      break;
+    case OP_Malloc:
+      set(instr.mA, mBuilder.CreateCall(
+                        helper("asti_jit_malloc", intType(),
+                               {mCtx->getType(), intType()}),
+                        {mCtx, get(instr.mB)}));
+      break;
+    case OP_Free:
+      mBuilder.CreateCall(helper("asti_jit_free", mBuilder.getVoidTy(),
+                                 {mCtx->getType(), intType()}),
+                          {mCtx, get(instr.mA)});
+      break;
+    case OP_Native: {
+      llvm::Value *args = passArgs(
+          instr.mC, mEnv.getBuiltins().getNative(instr.mB).mNumParams);
+      set(instr.mA,
+          mBuilder.CreateCall(
+              helper("asti_jit_native", intType(),
+                     {mCtx->getType(), intType(), args->getType()}),
+              {mCtx, imm(instr.mB), args}));
+      break;
+    }
+    }
+  }
+
+public:
+  JITLowering(Environment &env, BytecodeModule &module, unsigned idx,
+              llvm::Module &ir)
+      : mEnv(env), mModule(module), mIdx(idx), mFn(module.get(idx)),
+        mIR(ir), mContext(ir.getContext()), mBuilder(ir.getContext()),
+        mFunction(nullptr), mCtx(nullptr), mMemory(nullptr),
+        mGlobals(nullptr), mMem(nullptr), mRegs(), mArgv(nullptr),
+        mStart(nullptr), mBlocks() {}
+
+  /// JITContext as seen by the IR
+  static llvm::StructType *contextType(llvm::LLVMContext &context) {
+    llvm::Type *bytePtr = llvm::Type::getInt8PtrTy(context);
+    return llvm::StructType::get(
+        context, {bytePtr, bytePtr, llvm::Type::getInt32PtrTy(context),
+                  bytePtr});
+  }
+  static llvm::FunctionType *functionType(llvm::LLVMContext &context) {
+    return llvm::FunctionType::get(
+        llvm::Type::getInt32Ty(context),
+        {llvm::PointerType::getUnqual(contextType(context)),
+         llvm::Type::getInt32PtrTy(context)},
+        false);
+  }
+  /// the symbol of function \p idx in the JIT
+  static std::string symbolName(BytecodeModule &module, unsigned idx) {
+    return ("asti." + module.get(idx).mDecl->getName() + "." +
+            llvm::Twine(idx))
+        .str();
+  }
+
+  /// the function, with the bytecode already compiled
+  llvm::Function *lower() {
+    /// the calls lowered before may have declared it already
+    std::string name = symbolName(mModule, mIdx);
+    mFunction = mIR.getFunction(name);
+    if (!mFunction)
+      mFunction = llvm::Function::Create(functionType(mContext),
+                                         llvm::Function::ExternalLinkage,
+                                         name, &mIR);
+    auto arg = mFunction->arg_begin();
+    mCtx = &*arg++;
+    llvm::Value *args = &*arg;
+    mCtx->setName("ctx");
+    args->setName("args");
+    lowerPrologue(args);
+    createBlocks();
+    const std::vector<Instr> &code = mFn.mCode;
+    for (size_t i = 0; i < code.size(); i++) {
+      if (mBlocks[i]) {
+        if (!mBuilder.GetInsertBlock()->getTerminator())
+          mBuilder.CreateBr(mBlocks[i]);
+        mBuilder.SetInsertPoint(mBlocks[i]);
+      }
+      lowerInstr(code[i], i);
+    }
+    /// only reachable if the bytecode ran off its end
+    if (llvm::BasicBlock *end = mBlocks[code.size()]) {
+      mBuilder.SetInsertPoint(end);
+      mBuilder.CreateUnreachable();
+    }
+    return mFunction;
+  }
+};
+
+/// JIT compiles the bytecode of functions to native code with an LLVM ORC
+/// LLJIT (`--jit`). A function is compiled together with every function it
+/// calls that has no native code yet, so native code only ever calls native
+/// code, directly and through the JITFunction ABI. The builtins, native
+/// library functions and frame Memory are reached through the helpers below,
+/// which call into the Environment like the bytecode engine does.
+class JIT {
+  Environment &mEnv;
+  BytecodeModule &mModule;
+  std::unique_ptr<llvm::orc::LLJIT> mJIT;
+  llvm::orc::ThreadSafeContext mContext;
+  /// native code of the functions by index, null if there is none yet
+  std::vector<JITFunction> mNative;
+  /// functions LLVM failed to compile, they stay with the bytecode engine
+  llvm::DenseSet<unsigned> mFailed;
+  JITContext mCtx;
+
+  /// stack kept free for the helpers, which may print or throw
+  static const size_t STACK_MARGIN = 256 << 10;
+
+  static int helperGet(JITContext *ctx) { return ctx->mEnv->builtinGet(); }
+  static void helperPrint(JITContext *ctx, int val) {
+    ctx->mEnv->builtinPrint(val);
+  }
+  static int helperMalloc(JITContext *ctx, int size) {
+    return ctx->mEnv->builtinMalloc(size);
+  }
+  static void helperFree(JITContext *ctx, int addr) {
+    ctx->mEnv->builtinFree(addr);
+  }
+  static int helperNative(JITContext *ctx, int idx, const int *args) {
+    return ctx->mEnv->callNative(idx, args);
+  }
+  static int helperEnter(JITContext *ctx, int size) {
+    return ctx->mEnv->getMemory().stackAlloc(size);
+  }
+  static void helperLeave(JITContext *ctx, int addr) {
+    ctx->mEnv->getMemory().stackRelease(addr);
+  }
+  static void helperOverflow(JITContext *) {
+    llvm::errs() << "native stack overflow in JIT compiled code, run "
+                    "without --jit or raise the stack limit (ulimit -s)\n";
+    throw std::exception();
+  }
+
+  JIT(Environment &env, BytecodeModule &module,
+      std::unique_ptr<llvm::orc::LLJIT> jit)
+      : mEnv(env), mModule(module), mJIT(std::move(jit)),
+        mContext(std::unique_ptr<llvm::LLVMContext>(new llvm::LLVMContext())),
+        mNative(), mFailed(),
+        mCtx{&env, env.getMemory().data(), env.globalScope().slotData(),
+             nullptr} {}
+
+  /// make the helpers visible to the native code
+  llvm::Error defineHelpers() {
+    llvm::orc::MangleAndInterner mangle(mJIT->getExecutionSession(),
+                                        mJIT->getDataLayout());
+    llvm::orc::SymbolMap helpers;
+    auto define = [&](const char *name, void *addr) {
+      helpers[mangle(name)] = llvm::JITEvaluatedSymbol(
+          llvm::pointerToJITTargetAddress(addr),
+          llvm::JITSymbolFlags::Exported);
+    };
+    define("asti_jit_get", (void *)&helperGet);
+    define("asti_jit_print", (void *)&helperPrint);
+    define("asti_jit_malloc", (void *)&helperMalloc);
+    define("asti_jit_free", (void *)&helperFree);
+    define("asti_jit_native", (void *)&helperNative);
+    define("asti_jit_enter", (void *)&helperEnter);
+    define("asti_jit_leave", (void *)&helperLeave);
+    define("asti_jit_overflow", (void *)&helperOverflow);
+    return mJIT->getMainJITDylib().define(
+        llvm::orc::absoluteSymbols(std::move(helpers)));
+  }
+
+  /// the lowest address of this thread's stack, null if it is unknown
+  static char *stackBottom() {
+    pthread_attr_t attr;
+    void *addr = nullptr;
+    size_t size = 0;
+    if (pthread_getattr_np(pthread_self(), &attr) != 0)
+      return nullptr;
+    pthread_attr_getstack(&attr, &addr, &size);
+    pthread_attr_destroy(&attr);
+    return (char *)addr;
+  }
+
+  static void optimize(llvm::Module &ir) {
+    llvm::legacy::FunctionPassManager passes(&ir);
+    passes.add(llvm::createPromoteMemoryToRegisterPass());
+    passes.add(llvm::createInstructionCombiningPass());
+    passes.add(llvm::createReassociatePass());
+    passes.add(llvm::createGVNPass());
+    passes.add(llvm::createCFGSimplificationPass());
+    passes.doInitialization();
+    for (llvm::Function &func : ir)
+      if (!func.isDeclaration())
+        passes.run(func);
+    passes.doFinalization();
+  }
+
+  JITFunction &native(unsigned idx) {
+    if (idx >= mNative.size())
+      mNative.resize(idx + 1, nullptr);
+    return mNative[idx];
+  }
+
+  JITFunction fail(const std::vector<unsigned> &batch,
+                   const std::string &why) {
+    llvm::errs() << "warning: cannot JIT compile "
+                 << mModule.get(batch[0]).mDecl->getName() << ": " << why
+                 << "\n";
+    mFailed.insert(batch.begin(), batch.end());
+    return nullptr;
+  }
+
+public:
+  /// null, after a warning, if LLVM cannot JIT compile for this host
+  static std::unique_ptr<JIT> create(Environment &env,
+                                     BytecodeModule &module) {
+    /// once per process, the workers of `--serve` may get here together
+    static const bool initialized = [] {
+      llvm::InitializeNativeTarget();
+      llvm::InitializeNativeTargetAsmPrinter();
+      return true;
+    }();
+    (void)initialized;
+    auto jit = llvm::orc::LLJITBuilder().create();
+    if (!jit) {
+      llvm::errs() << "warning: cannot create the JIT, --jit is ignored: "
+                   << llvm::toString(jit.takeError()) << "\n";
+      return nullptr;
+    }
+    std::unique_ptr<JIT> result(new JIT(env, module, std::move(*jit)));
+    if (llvm::Error err = result->defineHelpers()) {
+      llvm::errs() << "warning: cannot create the JIT, --jit is ignored: "
+                   << llvm::toString(std::move(err)) << "\n";
+      return nullptr;
+    }
+    return result;
+  }
+
+  /// Native code of function \p idx of the module, compiled with every
+  /// function it calls on first use; null if LLVM failed to compile it.
+  JITFunction get(unsigned idx) {
+    if (JITFunction fn = native(idx))
+      return fn;
+    if (mFailed.count(idx))
+      return nullptr;
+
+    /// idx and the functions it calls, transitively, without native code
+    std::vector<unsigned> batch{idx};
+    llvm::DenseSet<unsigned> seen;
+    seen.insert(idx);
+    for (size_t i = 0; i < batch.size(); i++) {
+      BCFunction &fn = compiledFunction(mEnv, mModule, batch[i]);
+      for (const Instr &instr : fn.mCode) {
+        if (instr.mOp != OP_Call && instr.mOp != OP_TailCall)
+          continue;
+        unsigned callee = instr.mB;
+        if (mFailed.count(callee))
+          return fail(batch, "it calls a function that cannot be compiled");
+        if (!native(callee) && seen.insert(callee).second)
+          batch.push_back(callee);
+      }
+    }
+
+    {
+      auto lock = mContext.getLock();
+      std::unique_ptr<llvm::Module> ir(
+          new llvm::Module("asti.jit", *mContext.getContext()));
+      ir->setDataLayout(mJIT->getDataLayout());
+      for (unsigned fnIdx : batch) {
+        llvm::Function *func = JITLowering(mEnv, mModule, fnIdx, *ir).lower();
+        std::string error;
+        llvm::raw_string_ostream os(error);
+        if (llvm::verifyFunction(*func, &os))
+          return fail(batch, os.str());
+      }
+      optimize(*ir);
+      if (llvm::Error err = mJIT->addIRModule(
+              llvm::orc::ThreadSafeModule(std::move(ir), mContext)))
+        return fail(batch, llvm::toString(std::move(err)));
+    }
+    for (unsigned fnIdx : batch) {
+      auto symbol = mJIT->lookup(JITLowering::symbolName(mModule, fnIdx));
+      if (!symbol)
+        return fail(batch, llvm::toString(symbol.takeError()));
+      native(fnIdx) = (JITFunction)symbol->getAddress();
+      ASTI_TRACE(TL_Info, "JIT compiled " << mModule.get(fnIdx).mDecl->getName()
+                                          << "\n");
+    }
+    return native(idx);
+  }
+
+  /// run native code \p fn with \p args on the current thread
+  int call(JITFunction fn, const int *args) {
+    char *bottom = stackBottom();
+    mCtx.mStackLimit = bottom ? bottom + STACK_MARGIN : nullptr;
+    return fn(&mCtx, args);
+  }
+};
+
+#endif // ASTI_JIT
+
+#endif
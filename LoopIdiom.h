@@ -0,0 +1,292 @@
+//==--- LoopIdiom.h - Array loops that run as one vectorized operation -----==//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_LOOPIDIOM_H
+#define AST_INTERPRETER_LOOPIDIOM_H
+
+#include <vector>
+
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "llvm/ADT/DenseMap.h"
+
+#include "ConstantFolder.h"
+#include "Resolver.h"
+
+using namespace clang;
+
+/// What a recognized loop does, `i` running from its value before the loop
+/// up to `n` (`i < n` or `i <= n`, `i = i + 1`):
+///
+///   LI_Fill   a[i] = v;
+///   LI_Copy   a[i] = b[i];
+///   LI_Sum    s = s + a[i];
+///   LI_Find   if (a[i] == b[i]) break;     (or `!=`, or `a[i] == v`)
+enum IdiomKind { LI_Fill, LI_Copy, LI_Sum, LI_Find };
+
+/// A value the loop does not change: a constant, a variable in a frame slot
+/// or the address of an array variable
+struct IdiomOperand {
+  enum Kind { IO_Imm, IO_Var, IO_Array };
+  Kind mKind;
+  int mImm;
+  VarSlot mSlot;
+};
+
+struct LoopIdiom {
+  IdiomKind mKind;
+  /// the induction variable, always in a frame slot
+  VarSlot mIndex;
+  IdiomOperand mBound;
+  /// `i <= n` rather than `i < n`
+  bool mInclusive;
+  /// base of the array that is written (fill, copy) or read (sum, find)
+  IdiomOperand mArray;
+  /// the source array of a copy, the other array of a find, the value of a
+  /// fill or of a find against a value
+  IdiomOperand mOther;
+  /// mOther is an array indexed by `i` too
+  bool mOtherIsArray;
+  /// bytes of an element
+  int mElemSize;
+  /// the accumulator of a sum
+  VarSlot mAccum;
+  /// a find stops on `==` rather than `!=`
+  bool mEqual;
+};
+
+/// IdiomRecognizer walks the program once before execution, next to the
+/// ConstantFolder, and finds the `for` loops of the form above. The
+/// preconditions are proved on the AST:
+///
+/// - the body is the one statement, so there are no calls or other stores
+/// - `i`, `n`, `v` and `s` live in frame slots, which no store to an array
+///   can reach, and the loop assigns only `i`, `s` and the elements
+/// - the arrays are array variables, whose address is fixed, or pointers in
+///   frame slots
+/// - sums and finds are over `int` elements, fills and copies over elements
+///   of any size, a copy between elements of the same size
+///
+/// What depends on the values, like copies between overlapping ranges, is
+/// checked by Environment::runIdiom, which falls back to running the loop.
+class IdiomRecognizer : public RecursiveASTVisitor<IdiomRecognizer> {
+  const Resolver &mResolver;
+  const ConstantFolder &mFolder;
+  std::vector<LoopIdiom> mIdioms;
+  llvm::DenseMap<const ForStmt *, unsigned> mIndex;
+
+  /// an int variable in a frame slot
+  bool slotVar(Expr *expr, VarSlot &slot) const {
+    DeclRefExpr *declref = dyn_cast<DeclRefExpr>(expr->IgnoreParenImpCasts());
+    if (!declref || !isa<VarDecl>(declref->getDecl()))
+      return false;
+    QualType type = declref->getType();
+    if (!type->isIntegerType() || typeSize(type) != sizeof(int))
+      return false;
+    slot = mResolver.getSlot(declref->getDecl());
+    return !slot.mInMemory;
+  }
+
+  static bool sameSlot(const VarSlot &a, const VarSlot &b) {
+    return a.mGlobal == b.mGlobal && a.mIndex == b.mIndex;
+  }
+
+  /// a constant or an int variable in a frame slot other than \p index
+  bool invariant(Expr *expr, const VarSlot &index, IdiomOperand &op) const {
+    if (const int *value = mFolder.lookup(expr)) {
+      op.mKind = IdiomOperand::IO_Imm;
+      op.mImm = *value;
+      return true;
+    }
+    if (IntegerLiteral *literal =
+            dyn_cast<IntegerLiteral>(expr->IgnoreParenImpCasts())) {
+      op.mKind = IdiomOperand::IO_Imm;
+      op.mImm = literal->getValue().getSExtValue();
+      return true;
+    }
+    op.mKind = IdiomOperand::IO_Var;
+    return slotVar(expr, op.mSlot) && !sameSlot(op.mSlot, index);
+  }
+
+  /// `base[i]` over an array variable or a pointer in a frame slot
+  bool element(Expr *expr, const VarSlot &index, IdiomOperand &base,
+               int &size) const {
+    ArraySubscriptExpr *arrsub =
+        dyn_cast<ArraySubscriptExpr>(expr->IgnoreParenImpCasts());
+    if (!arrsub)
+      return false;
+    QualType type = arrsub->getType();
+    if (type->isArrayType() ||
+        !(type->isIntegerType() || type->isPointerType()))
+      return false;
+    VarSlot idx;
+    if (!slotVar(arrsub->getIdx(), idx) || !sameSlot(idx, index))
+      return false;
+    DeclRefExpr *declref =
+        dyn_cast<DeclRefExpr>(arrsub->getBase()->IgnoreParenImpCasts());
+    if (!declref || !isa<VarDecl>(declref->getDecl()))
+      return false;
+    base.mSlot = mResolver.getSlot(declref->getDecl());
+    if (declref->getType()->isArrayType())
+      base.mKind = IdiomOperand::IO_Array;
+    else if (declref->getType()->isPointerType() && !base.mSlot.mInMemory)
+      base.mKind = IdiomOperand::IO_Var;
+    else
+      return false;
+    size = typeSize(type);
+    return true;
+  }
+
+  /// `i = i + 1` or `i = 1 + i`
+  bool increment(Expr *inc, const VarSlot &index) const {
+    BinaryOperator *assign = dyn_cast_or_null<BinaryOperator>(inc);
+    if (!assign || assign->getOpcode() != BO_Assign)
+      return false;
+    VarSlot lhs;
+    if (!slotVar(assign->getLHS(), lhs) || !sameSlot(lhs, index))
+      return false;
+    BinaryOperator *add =
+        dyn_cast<BinaryOperator>(assign->getRHS()->IgnoreParenImpCasts());
+    if (!add || add->getOpcode() != BO_Add)
+      return false;
+    VarSlot var;
+    Expr *other;
+    if (slotVar(add->getLHS(), var) && sameSlot(var, index))
+      other = add->getRHS();
+    else if (slotVar(add->getRHS(), var) && sameSlot(var, index))
+      other = add->getLHS();
+    else
+      return false;
+    IdiomOperand one;
+    return invariant(other, index, one) && one.mKind == IdiomOperand::IO_Imm &&
+           one.mImm == 1;
+  }
+
+  /// the one statement of \p stmt, looking through `{ }`
+  static Stmt *single(Stmt *stmt) {
+    while (CompoundStmt *body = dyn_cast_or_null<CompoundStmt>(stmt)) {
+      if (body->size() != 1)
+        return nullptr;
+      stmt = body->body_front();
+    }
+    return stmt;
+  }
+
+  /// `a[i] = v`, `a[i] = b[i]` or `s = s + a[i]`
+  bool matchAssign(BinaryOperator *assign, LoopIdiom &idiom) const {
+    if (assign->getOpcode() != BO_Assign)
+      return false;
+    Expr *rhs = assign->getRHS();
+    if (element(assign->getLHS(), idiom.mIndex, idiom.mArray,
+                idiom.mElemSize)) {
+      int otherSize;
+      if (element(rhs, idiom.mIndex, idiom.mOther, otherSize)) {
+        idiom.mKind = LI_Copy;
+        idiom.mOtherIsArray = true;
+        return otherSize == idiom.mElemSize;
+      }
+      idiom.mKind = LI_Fill;
+      return invariant(rhs, idiom.mIndex, idiom.mOther);
+    }
+    if (!slotVar(assign->getLHS(), idiom.mAccum) ||
+        sameSlot(idiom.mAccum, idiom.mIndex))
+      return false;
+    BinaryOperator *add = dyn_cast<BinaryOperator>(rhs->IgnoreParenImpCasts());
+    if (!add || add->getOpcode() != BO_Add)
+      return false;
+    VarSlot accum;
+    Expr *other;
+    if (slotVar(add->getLHS(), accum) && sameSlot(accum, idiom.mAccum))
+      other = add->getRHS();
+    else if (slotVar(add->getRHS(), accum) && sameSlot(accum, idiom.mAccum))
+      other = add->getLHS();
+    else
+      return false;
+    idiom.mKind = LI_Sum;
+    return element(other, idiom.mIndex, idiom.mArray, idiom.mElemSize) &&
+           idiom.mElemSize == sizeof(int) &&
+           other->IgnoreParenImpCasts()->getType()->isIntegerType();
+  }
+
+  /// `if (a[i] == b[i]) break;`, `!=`, or against a value
+  bool matchFind(IfStmt *ifstmt, LoopIdiom &idiom) const {
+    if (ifstmt->getElse() || !isa_and_nonnull<BreakStmt>(
+                                 single(ifstmt->getThen())))
+      return false;
+    BinaryOperator *cmp =
+        dyn_cast<BinaryOperator>(ifstmt->getCond()->IgnoreParenImpCasts());
+    if (!cmp || !cmp->isEqualityOp())
+      return false;
+    idiom.mKind = LI_Find;
+    idiom.mEqual = cmp->getOpcode() == BO_EQ;
+    Expr *lhs = cmp->getLHS();
+    Expr *rhs = cmp->getRHS();
+    if (!element(lhs, idiom.mIndex, idiom.mArray, idiom.mElemSize))
+      std::swap(lhs, rhs);
+    if (!element(lhs, idiom.mIndex, idiom.mArray, idiom.mElemSize) ||
+        idiom.mElemSize != sizeof(int) ||
+        !lhs->IgnoreParenImpCasts()->getType()->isIntegerType())
+      return false;
+    int otherSize;
+    if (element(rhs, idiom.mIndex, idiom.mOther, otherSize)) {
+      idiom.mOtherIsArray = true;
+      return otherSize == sizeof(int) &&
+             rhs->IgnoreParenImpCasts()->getType()->isIntegerType();
+    }
+    return invariant(rhs, idiom.mIndex, idiom.mOther);
+  }
+
+  bool match(ForStmt *fstmt, LoopIdiom &idiom) const {
+    BinaryOperator *cond =
+        dyn_cast_or_null<BinaryOperator>(fstmt->getCond());
+    if (!cond ||
+        (cond->getOpcode() != BO_LT && cond->getOpcode() != BO_LE) ||
+        !slotVar(cond->getLHS(), idiom.mIndex) ||
+        !invariant(cond->getRHS(), idiom.mIndex, idiom.mBound) ||
+        !increment(fstmt->getInc(), idiom.mIndex))
+      return false;
+    idiom.mInclusive = cond->getOpcode() == BO_LE;
+    Stmt *body = single(fstmt->getBody());
+    bool matched = false;
+    if (BinaryOperator *assign = dyn_cast_or_null<BinaryOperator>(body))
+      matched = matchAssign(assign, idiom);
+    else if (IfStmt *ifstmt = dyn_cast_or_null<IfStmt>(body))
+      matched = matchFind(ifstmt, idiom);
+    if (!matched)
+      return false;
+    /// the bound must not be what the loop assigns
+    return idiom.mKind != LI_Sum ||
+           idiom.mBound.mKind != IdiomOperand::IO_Var ||
+           !sameSlot(idiom.mBound.mSlot, idiom.mAccum);
+  }
+
+public:
+  IdiomRecognizer(const Resolver &resolver, const ConstantFolder &folder)
+      : mResolver(resolver), mFolder(folder), mIdioms(), mIndex() {}
+
+  void run(TranslationUnitDecl *unit) {
+    for (Decl *decl : unit->decls())
+      if (FunctionDecl *fdecl = dyn_cast<FunctionDecl>(decl))
+        if (fdecl->doesThisDeclarationHaveABody())
+          TraverseStmt(fdecl->getBody());
+  }
+
+  bool VisitForStmt(ForStmt *fstmt) {
+    LoopIdiom idiom = LoopIdiom();
+    if (match(fstmt, idiom)) {
+      mIndex[fstmt] = mIdioms.size();
+      mIdioms.push_back(idiom);
+    }
+    return true;
+  }
+
+  /// the index of the idiom of \p fstmt, -1 if it is an ordinary loop
+  int lookup(const ForStmt *fstmt) const {
+    auto it = mIndex.find(fstmt);
+    return it == mIndex.end() ? -1 : (int)it->second;
+  }
+  const LoopIdiom &get(unsigned idx) const { return mIdioms[idx]; }
+
+  /// number of recognized loops
+  unsigned size() const { return mIdioms.size(); }
+};
+
+#endif
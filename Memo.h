@@ -0,0 +1,180 @@
+//==--- Memo.h - Memoization of the calls to pure functions ----------------==//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_MEMO_H
+#define AST_INTERPRETER_MEMO_H
+
+#include <cstring>
+#include <vector>
+
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "Builtins.h"
+#include "Resolver.h"
+#include "Trace.h"
+
+using namespace clang;
+
+/// MemoCache maps (function, arguments) to the result of a call. It is
+/// direct-mapped: a power of two of entries, each call hashes to one of
+/// them and a new result replaces whatever was there, so the cache never
+/// grows or allocates after it is created.
+class MemoCache {
+public:
+  static const unsigned MAX_ARGS = 4;
+
+private:
+  struct Entry {
+    const FunctionDecl *mFn;
+    int mArgs[MAX_ARGS];
+    int mResult;
+  };
+  std::vector<Entry> mEntries;
+  size_t mMask;
+  unsigned long long mHits;
+  unsigned long long mMisses;
+
+  Entry &slot(const FunctionDecl *fn, const int *args, unsigned n) {
+    size_t hash = llvm::hash_combine(
+        fn, llvm::hash_combine_range(args, args + n));
+    return mEntries[hash & mMask];
+  }
+
+public:
+  /// at least \p entries entries, rounded up to a power of two
+  explicit MemoCache(unsigned entries)
+      : mEntries(), mMask(0), mHits(0), mMisses(0) {
+    size_t size = 1;
+    while (size < entries)
+      size <<= 1;
+    mEntries.assign(size, Entry{nullptr, {0}, 0});
+    mMask = size - 1;
+  }
+
+  /// the result of \p fn called with the \p n \p args, if it is cached
+  bool lookup(const FunctionDecl *fn, const int *args, unsigned n,
+              int &result) {
+    Entry &entry = slot(fn, args, n);
+    if (entry.mFn == fn && !memcmp(entry.mArgs, args, n * sizeof(int))) {
+      ++mHits;
+      result = entry.mResult;
+      return true;
+    }
+    ++mMisses;
+    return false;
+  }
+  void store(const FunctionDecl *fn, const int *args, unsigned n,
+             int result) {
+    Entry &entry = slot(fn, args, n);
+    entry.mFn = fn;
+    memcpy(entry.mArgs, args, n * sizeof(int));
+    entry.mResult = result;
+  }
+
+  void printStats(llvm::raw_ostream &os, unsigned pure) const {
+    os << "stats: memo-hits=" << mHits << " memo-misses=" << mMisses
+       << " pure-functions=" << pure << "\n";
+  }
+};
+
+/// PurityAnalysis finds the functions whose result depends only on their
+/// arguments and that do nothing else, so a call can be answered from a
+/// cache. A function is pure if its body
+///
+/// - uses only its own variables that live in frame slots: no globals, no
+///   arrays, no `&`, `*` or `[]`, so it neither reads nor writes Memory
+/// - calls no builtin (GET, PRINT, MALLOC, FREE) or native function, and
+///   only functions that are pure themselves
+/// - returns a value and takes at most MemoCache::MAX_ARGS arguments
+///
+/// Functions start out pure unless their body says otherwise, and calls to
+/// impure functions are propagated until nothing changes, so recursive
+/// functions can be pure.
+class PurityAnalysis : public RecursiveASTVisitor<PurityAnalysis> {
+  const Resolver &mResolver;
+  const BuiltinRegistry &mBuiltins;
+  llvm::DenseSet<const FunctionDecl *> mPure;
+  /// the functions each function calls
+  llvm::DenseMap<const FunctionDecl *, std::vector<const FunctionDecl *>>
+      mCallees;
+  /// the function whose body is traversed and whether it is pure so far
+  const FunctionDecl *mCurrent;
+  bool mCurrentPure;
+
+public:
+  PurityAnalysis(const Resolver &resolver, const BuiltinRegistry &builtins)
+      : mResolver(resolver), mBuiltins(builtins), mPure(), mCallees(),
+        mCurrent(nullptr), mCurrentPure(false) {}
+
+  void run(TranslationUnitDecl *unit) {
+    std::vector<const FunctionDecl *> candidates;
+    for (Decl *decl : unit->decls()) {
+      FunctionDecl *fdecl = dyn_cast<FunctionDecl>(decl);
+      if (!fdecl || !fdecl->doesThisDeclarationHaveABody())
+        continue;
+      mCurrent = fdecl;
+      mCurrentPure = !fdecl->getReturnType()->isVoidType() &&
+                     fdecl->getNumParams() <= MemoCache::MAX_ARGS;
+      TraverseStmt(fdecl->getBody());
+      if (mCurrentPure) {
+        mPure.insert(fdecl);
+        candidates.push_back(fdecl);
+      }
+    }
+    mCurrent = nullptr;
+    /// a function that calls an impure one is impure
+    for (bool changed = true; changed;) {
+      changed = false;
+      for (const FunctionDecl *fdecl : candidates) {
+        if (!mPure.count(fdecl))
+          continue;
+        for (const FunctionDecl *callee : mCallees[fdecl])
+          if (!mPure.count(callee)) {
+            mPure.erase(fdecl);
+            changed = true;
+            break;
+          }
+      }
+    }
+    for (const FunctionDecl *fdecl : candidates)
+      if (mPure.count(fdecl))
+        ASTI_TRACE(TL_Info, fdecl->getName() << " is pure, its calls are "
+                                                "memoized\n");
+  }
+
+  bool VisitDeclRefExpr(DeclRefExpr *declref) {
+    if (isa<VarDecl>(declref->getDecl())) {
+      VarSlot slot = mResolver.getSlot(declref->getDecl());
+      if (slot.mGlobal || slot.mInMemory)
+        mCurrentPure = false;
+    }
+    return true;
+  }
+  bool VisitArraySubscriptExpr(ArraySubscriptExpr *) {
+    mCurrentPure = false;
+    return true;
+  }
+  bool VisitUnaryOperator(UnaryOperator *uop) {
+    if (uop->getOpcode() == UO_Deref || uop->getOpcode() == UO_AddrOf)
+      mCurrentPure = false;
+    return true;
+  }
+  bool VisitCallExpr(CallExpr *call) {
+    FunctionDecl *callee = call->getDirectCallee();
+    const CallTarget *target = callee ? &mBuiltins.lookup(callee) : nullptr;
+    if (!target || target->mKind != BK_None || !target->mDefinition)
+      mCurrentPure = false;
+    else
+      mCallees[mCurrent].push_back(target->mDefinition);
+    return true;
+  }
+
+  /// \p fdecl is a definition
+  bool isPure(const FunctionDecl *fdecl) const { return mPure.count(fdecl); }
+  unsigned size() const { return mPure.size(); }
+};
+
+#endif
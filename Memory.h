@@ -0,0 +1,171 @@
+//==--- Memory.h - Address space of the interpreted program -----------------==//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_MEMORY_H
+#define AST_INTERPRETER_MEMORY_H
+
+#include <cassert>
+#include <cstring>
+#include <exception>
+#include <sys/mman.h>
+
+#include "llvm/Support/raw_ostream.h"
+
+#include "Trace.h"
+
+/// Memory is the one byte-addressable address space of the program. A
+/// pointer value is an offset into it, whatever it points to:
+///
+///   [0, GLOBAL_BASE)            never mapped, so NULL stays invalid
+///   [GLOBAL_BASE, STACK_BASE)   global arrays and variables
+///   [STACK_BASE, HEAP_BASE)     arrays and variables of the calls, released
+///                               on return
+///   [HEAP_BASE, LIMIT)          MALLOC/FREE, managed by Heap
+///
+/// The whole range is reserved up front and pages are committed as a segment
+/// grows into them, so nothing ever moves. Only variables that need an
+/// address live here; the other ones stay in the frame slots.
+class Memory {
+public:
+  typedef int Addr;
+
+  static const Addr GLOBAL_BASE = 1 << 12;
+  static const Addr STACK_BASE = GLOBAL_BASE + (64 << 20);
+  static const Addr HEAP_BASE = STACK_BASE + (256 << 20);
+  static const Addr LIMIT = HEAP_BASE + (1 << 30);
+  /// sizeof(int*) in the interpreted program
+  static const int PTR_SIZE = sizeof(Addr);
+  static const int ALIGN = 8;
+
+  /// a part of the address space that grows upwards from mBase
+  struct Segment {
+    Addr mBase;
+    Addr mLimit;
+    /// [mBase, mCommitted) is readable and writable
+    Addr mCommitted;
+
+    Segment(Addr base, Addr limit)
+        : mBase(base), mLimit(limit), mCommitted(base) {}
+  };
+
+private:
+  static const size_t COMMIT_CHUNK = size_t(1) << 20;
+
+  char *mBase;
+  Segment mGlobals;
+  Segment mStack;
+  Addr mGlobalTop;
+  Addr mStackTop;
+
+  static Addr alignUp(Addr addr) { return (addr + ALIGN - 1) & ~(ALIGN - 1); }
+
+  [[noreturn]] void overflow(const char *what, int size) {
+    llvm::errs() << what << " exhausted allocating " << size << " bytes\n";
+    throw std::exception();
+  }
+
+public:
+  Memory()
+      : mBase(nullptr), mGlobals(GLOBAL_BASE, STACK_BASE),
+        mStack(STACK_BASE, HEAP_BASE), mGlobalTop(GLOBAL_BASE),
+        mStackTop(STACK_BASE) {
+    void *ptr = mmap(nullptr, LIMIT, PROT_NONE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    assert(ptr != MAP_FAILED && "cannot reserve the address space");
+    mBase = (char *)ptr;
+  }
+  ~Memory() { munmap(mBase, LIMIT); }
+  Memory(const Memory &) = delete;
+  Memory &operator=(const Memory &) = delete;
+
+  /// commit \p seg up to \p end; false if that is past its limit
+  bool reach(Segment &seg, size_t end) {
+    if (end <= (size_t)seg.mCommitted)
+      return true;
+    if (end > (size_t)seg.mLimit)
+      return false;
+    size_t commit = seg.mBase + (end - seg.mBase + COMMIT_CHUNK - 1) /
+                                    COMMIT_CHUNK * COMMIT_CHUNK;
+    if (commit > (size_t)seg.mLimit)
+      commit = seg.mLimit;
+    if (mprotect(mBase + seg.mCommitted, commit - seg.mCommitted,
+                 PROT_READ | PROT_WRITE) != 0)
+      return false;
+    seg.mCommitted = commit;
+    return true;
+  }
+
+  /// zeroed storage of the globals, lives as long as the program
+  Addr globalAlloc(int size) {
+    Addr addr = mGlobalTop;
+    if (!reach(mGlobals, (size_t)addr + size))
+      overflow("global memory", size);
+    memset(mBase + addr, 0, size);
+    mGlobalTop = alignUp(addr + size);
+    return addr;
+  }
+
+  /// zeroed storage of one call, released with `stackRelease()`
+  Addr stackAlloc(int size) {
+    Addr addr = mStackTop;
+    if (!reach(mStack, (size_t)addr + size))
+      overflow("stack memory", size);
+    memset(mBase + addr, 0, size);
+    mStackTop = alignUp(addr + size);
+    return addr;
+  }
+  /// release \p addr and everything allocated on the stack after it
+  void stackRelease(Addr addr) {
+    assert(addr >= STACK_BASE && addr <= mStackTop);
+    mStackTop = addr;
+  }
+
+  char *data() { return mBase; }
+
+  int loadInt(Addr addr) {
+    assert(addr >= GLOBAL_BASE && addr <= LIMIT - (Addr)sizeof(int));
+    int val;
+    memcpy(&val, mBase + addr, sizeof(int));
+    return val;
+  }
+  void storeInt(Addr addr, int val) {
+    assert(addr >= GLOBAL_BASE && addr <= LIMIT - (Addr)sizeof(int));
+    memcpy(mBase + addr, &val, sizeof(int));
+    ASTI_TRACE(TL_Trace, "Update *" << addr << " -> " << val << "\n");
+  }
+
+  /// the \p size byte integer at \p addr, sign extended if \p isSigned
+  int load(Addr addr, int size, bool isSigned) {
+    assert(addr >= GLOBAL_BASE && addr <= LIMIT - size);
+    switch (size) {
+    case 1:
+      return isSigned ? (int)*(signed char *)(mBase + addr)
+                      : (int)*(unsigned char *)(mBase + addr);
+    case 2: {
+      short val;
+      memcpy(&val, mBase + addr, sizeof(short));
+      return isSigned ? (int)val : (int)(unsigned short)val;
+    }
+    default:
+      return loadInt(addr);
+    }
+  }
+  /// store the low \p size bytes of \p val at \p addr
+  void store(Addr addr, int val, int size) {
+    assert(addr >= GLOBAL_BASE && addr <= LIMIT - size);
+    switch (size) {
+    case 1:
+      *(char *)(mBase + addr) = (char)val;
+      break;
+    case 2: {
+      short sval = (short)val;
+      memcpy(mBase + addr, &sval, sizeof(short));
+      break;
+    }
+    default:
+      storeInt(addr, val);
+      break;
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,68 @@
+//==--- Options.h - Command line options of the interpreter ----------------==//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_OPTIONS_H
+#define AST_INTERPRETER_OPTIONS_H
+
+#include <string>
+#include <vector>
+
+#include "FrameArena.h"
+
+/// Options given on the command line before the program text, e.g.
+/// `ast-interpreter --bytecode "$(cat test.c)"`.
+/// `--trace=off|info|trace` sets traceLevel() directly, see Trace.h.
+struct InterpreterOptions {
+  /// run functions with the bytecode engine instead of the AST walker
+  bool mBytecode;
+  /// compile the bytecode of the functions to native code (`--jit`, needs
+  /// the ASTI_JIT build option)
+  bool mJIT;
+  /// MB the frames of all active calls may take (`--stack-size=<MB>`)
+  size_t mStackSize;
+  /// directory of the parsed programs (`--ast-cache=<dir>`), empty if
+  /// every run parses
+  std::string mASTCache;
+  /// print what the run cost on stdout when it ends (`--stats`)
+  bool mStats;
+  /// profile the run and print the most expensive functions and statements
+  /// (`--profile`)
+  bool mProfile;
+  /// file the collapsed call stacks of the profile are written to
+  /// (`--profile=<file>`), empty for none
+  std::string mProfileStacks;
+  /// sample the interpreted call stack and print where the samples fell
+  /// (`--sample`)
+  bool mSample;
+  /// file the collapsed stacks of the samples are written to
+  /// (`--sample=<file>`), empty for none
+  std::string mSampleStacks;
+  /// microseconds of CPU time between samples (`--sample-interval=<us>`)
+  unsigned mSampleInterval;
+  /// calls of a function, or iterations of a loop, after which the walker
+  /// promotes it to the bytecode engine (`--tier-threshold=<n>`, 0 never)
+  unsigned mTierThreshold;
+  /// results of pure functions that are cached (`--memo[=<entries>]`), 0
+  /// if calls are not memoized
+  unsigned mMemoSize;
+  /// start `main` from the state the global initializers left in an earlier
+  /// run (`--snapshot`), see Snapshot.h; needs mASTCache or `--serve`
+  bool mSnapshot;
+  /// shared libraries whose functions are called natively when the program
+  /// declares them without a body (`--native=<lib.so>`, repeatable)
+  std::vector<std::string> mNativeLibs;
+
+  InterpreterOptions()
+      : mBytecode(false), mJIT(false),
+        mStackSize(FrameArena::DEFAULT_BUDGET >> 20), mASTCache(),
+        mStats(false), mProfile(false), mProfileStacks(), mSample(false),
+        mSampleStacks(), mSampleInterval(1000), mTierThreshold(100),
+        mMemoSize(0), mSnapshot(false), mNativeLibs() {}
+
+  static const unsigned DEFAULT_MEMO_SIZE = 1 << 16;
+
+  /// profiling only instruments the AST walker, and only the walker
+  /// memoizes calls
+  bool needsWalker() const { return mProfile || mSample || mMemoSize; }
+};
+
+#endif
@@ -0,0 +1,212 @@
+//==--- Profiler.h - Per-statement and per-function profile (--profile) ----==//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_PROFILER_H
+#define AST_INTERPRETER_PROFILER_H
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "clang/AST/Decl.h"
+#include "clang/AST/Stmt.h"
+#include "clang/Basic/SourceManager.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace clang;
+
+/// Counts how often every statement and function of the AST walker runs and
+/// how long it takes.
+///
+/// Inclusive time is everything between entering and leaving. The exclusive
+/// time of a statement leaves out the statements nested in it (including the
+/// bodies of the functions it calls); the exclusive time of a function leaves
+/// out the functions it calls. Recursion is counted once: only the outermost
+/// activation adds to the inclusive time.
+///
+/// The call stacks are kept as a tree, so the exclusive time of every
+/// distinct stack can be written in the collapsed format of flamegraph.pl:
+/// `main;fib;fib 1234` (nanoseconds).
+class Profiler {
+  typedef std::chrono::steady_clock Clock;
+  typedef unsigned long long Nanos;
+
+  struct Entry {
+    unsigned long long mCount;
+    Nanos mInclusive;
+    Nanos mExclusive;
+    /// activations still running, > 1 while recursing
+    unsigned mActive;
+
+    Entry() : mCount(0), mInclusive(0), mExclusive(0), mActive(0) {}
+  };
+
+  /// a statement being executed
+  struct OpenStmt {
+    const Stmt *mStmt;
+    Nanos mStart;
+    /// inclusive time of the statements nested directly in it
+    Nanos mChildren;
+  };
+
+  /// a call being executed
+  struct OpenCall {
+    const FunctionDecl *mFunction;
+    Nanos mStart;
+    /// inclusive time of the functions it called
+    Nanos mCallees;
+    unsigned mNode;
+  };
+
+  /// one distinct call stack: the stack of mParent plus mFunction
+  struct StackNode {
+    const FunctionDecl *mFunction;
+    unsigned mParent;
+    Nanos mSelf;
+    llvm::DenseMap<const FunctionDecl *, unsigned> mChildren;
+
+    StackNode(const FunctionDecl *function, unsigned parent)
+        : mFunction(function), mParent(parent), mSelf(0) {}
+  };
+
+  const SourceManager &mSources;
+  Clock::time_point mEpoch;
+  llvm::DenseMap<const Stmt *, Entry> mStmts;
+  llvm::DenseMap<const FunctionDecl *, Entry> mFunctions;
+  std::vector<OpenStmt> mOpenStmts;
+  std::vector<OpenCall> mOpenCalls;
+  /// mStackNodes[0] is the root, the stack with no function on it
+  std::vector<StackNode> mStackNodes;
+
+  Nanos now() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                                mEpoch)
+        .count();
+  }
+
+  static void leave(Entry &entry, Nanos inclusive, Nanos exclusive) {
+    if (--entry.mActive == 0)
+      entry.mInclusive += inclusive;
+    entry.mExclusive += exclusive;
+  }
+
+  unsigned childNode(unsigned parent, const FunctionDecl *fdecl) {
+    auto it = mStackNodes[parent].mChildren.find(fdecl);
+    if (it != mStackNodes[parent].mChildren.end())
+      return it->second;
+    unsigned node = mStackNodes.size();
+    mStackNodes[parent].mChildren[fdecl] = node;
+    mStackNodes.push_back(StackNode(fdecl, parent));
+    return node;
+  }
+
+  unsigned lineOf(SourceLocation loc) const {
+    return loc.isValid() ? mSources.getPresumedLineNumber(loc) : 0;
+  }
+
+  static double ms(Nanos nanos) { return nanos / 1e6; }
+
+  template <typename Key>
+  static std::vector<std::pair<Key, Entry>>
+  top(const llvm::DenseMap<Key, Entry> &entries, unsigned n,
+      Nanos Entry::*order) {
+    std::vector<std::pair<Key, Entry>> sorted(entries.begin(), entries.end());
+    std::sort(sorted.begin(), sorted.end(),
+              [order](const std::pair<Key, Entry> &a,
+                      const std::pair<Key, Entry> &b) {
+                return a.second.*order > b.second.*order;
+              });
+    if (sorted.size() > n)
+      sorted.resize(n);
+    return sorted;
+  }
+
+public:
+  explicit Profiler(const SourceManager &sources)
+      : mSources(sources), mEpoch(Clock::now()) {
+    mStackNodes.push_back(StackNode(nullptr, 0));
+  }
+
+  void enterStmt(const Stmt *stmt) {
+    Entry &entry = mStmts[stmt];
+    entry.mCount++;
+    entry.mActive++;
+    mOpenStmts.push_back(OpenStmt{stmt, now(), 0});
+  }
+
+  void leaveStmt() {
+    OpenStmt open = mOpenStmts.back();
+    mOpenStmts.pop_back();
+    Nanos inclusive = now() - open.mStart;
+    leave(mStmts[open.mStmt], inclusive, inclusive - open.mChildren);
+    if (!mOpenStmts.empty())
+      mOpenStmts.back().mChildren += inclusive;
+  }
+
+  void enterFunction(const FunctionDecl *fdecl) {
+    Entry &entry = mFunctions[fdecl];
+    entry.mCount++;
+    entry.mActive++;
+    unsigned parent = mOpenCalls.empty() ? 0 : mOpenCalls.back().mNode;
+    mOpenCalls.push_back(OpenCall{fdecl, now(), 0, childNode(parent, fdecl)});
+  }
+
+  void leaveFunction() {
+    OpenCall open = mOpenCalls.back();
+    mOpenCalls.pop_back();
+    Nanos inclusive = now() - open.mStart;
+    Nanos exclusive = inclusive - open.mCallees;
+    leave(mFunctions[open.mFunction], inclusive, exclusive);
+    mStackNodes[open.mNode].mSelf += exclusive;
+    if (!mOpenCalls.empty())
+      mOpenCalls.back().mCallees += inclusive;
+  }
+
+  /// close what is still running when the program ends, e.g. `main`, whose
+  /// frame is never popped
+  void finish() {
+    while (!mOpenStmts.empty())
+      leaveStmt();
+    while (!mOpenCalls.empty())
+      leaveFunction();
+  }
+
+  /// the \p n most expensive functions and statements
+  void printSummary(llvm::raw_ostream &os, unsigned n) const {
+    os << "profile: functions by inclusive time\n";
+    os << "       calls      incl ms      excl ms  function\n";
+    for (const auto &item : top(mFunctions, n, &Entry::mInclusive))
+      os << llvm::format("%12llu %12.3f %12.3f  ", item.second.mCount,
+                         ms(item.second.mInclusive),
+                         ms(item.second.mExclusive))
+         << item.first->getNameAsString() << " (line "
+         << lineOf(item.first->getLocation()) << ")\n";
+
+    os << "profile: statements by exclusive time\n";
+    os << "       count      incl ms      excl ms  statement\n";
+    for (const auto &item : top(mStmts, n, &Entry::mExclusive))
+      os << llvm::format("%12llu %12.3f %12.3f  ", item.second.mCount,
+                         ms(item.second.mInclusive),
+                         ms(item.second.mExclusive))
+         << "line " << lineOf(item.first->getBeginLoc()) << " "
+         << item.first->getStmtClassName() << "\n";
+  }
+
+  /// one line `f;g;h <exclusive ns>` per distinct call stack
+  void printCollapsedStacks(llvm::raw_ostream &os) const {
+    for (unsigned i = 1; i < mStackNodes.size(); i++) {
+      if (mStackNodes[i].mSelf == 0)
+        continue;
+      std::vector<const FunctionDecl *> stack;
+      for (unsigned node = i; node != 0; node = mStackNodes[node].mParent)
+        stack.push_back(mStackNodes[node].mFunction);
+      for (auto it = stack.rbegin(); it != stack.rend(); ++it)
+        os << (it == stack.rbegin() ? "" : ";") << (*it)->getNameAsString();
+      os << " " << mStackNodes[i].mSelf << "\n";
+    }
+  }
+};
+
+#endif
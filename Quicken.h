@@ -0,0 +1,122 @@
+//==--- Quicken.h - Specialized handlers of the operator nodes --------------==//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_QUICKEN_H
+#define AST_INTERPRETER_QUICKEN_H
+
+#include "clang/AST/Expr.h"
+
+using namespace clang;
+
+/// What an operand of an operator is, as far as its evaluation cares.
+enum OperandKind { OK_Int, OK_Ptr };
+
+/// A handler computing the value of one operator node from the values of its
+/// operands; unary operators ignore \p rhs. \p scale is the size of the
+/// pointee for pointer arithmetic.
+typedef int (*QuickKernel)(int lhs, int rhs, int scale);
+
+/// An operator node after its first evaluation: the handler it was
+/// specialized to and the temporaries of the node and its operands, so no
+/// type, opcode or temporary has to be looked up again.
+struct QuickOp {
+  /// null if the node has no specialized handler
+  QuickKernel mKernel;
+  unsigned mTemp;
+  unsigned mLHS;
+  unsigned mRHS;
+  /// at least 1 once the node is specialized, 0 before
+  int mScale;
+};
+
+/// \p Op on two ints. Op is a constant, so the switch folds away in every
+/// instantiation.
+template <BinaryOperatorKind Op> inline int applyBinary(int lhs, int rhs) {
+  switch (Op) {
+  case BO_Add: return lhs + rhs;
+  case BO_Sub: return lhs - rhs;
+  case BO_Mul: return lhs * rhs;
+  case BO_Div: return lhs / rhs;
+  case BO_Rem: return lhs % rhs;
+  case BO_LT: return lhs < rhs;
+  case BO_GT: return lhs > rhs;
+  case BO_LE: return lhs <= rhs;
+  case BO_GE: return lhs >= rhs;
+  case BO_EQ: return lhs == rhs;
+  case BO_NE: return lhs != rhs;
+  default: return 0;
+  }
+}
+
+/// `lhs Op rhs` with operands of kinds L and R; the same pointer arithmetic as
+/// Environment::handleAdditive
+template <BinaryOperatorKind Op, OperandKind L, OperandKind R>
+int binaryKernel(int lhs, int rhs, int scale) {
+  if (L == OK_Ptr && R == OK_Ptr)
+    return (lhs - rhs) / scale;
+  if (L == OK_Ptr)
+    rhs *= scale;
+  else if (R == OK_Ptr)
+    lhs *= scale;
+  return applyBinary<Op>(lhs, rhs);
+}
+
+template <UnaryOperatorKind Op> int unaryKernel(int sub, int, int) {
+  switch (Op) {
+  case UO_Plus: return sub;
+  case UO_Minus: return -sub;
+  case UO_Not: return ~sub;
+  case UO_LNot: return !sub;
+  default: return 0;
+  }
+}
+
+template <BinaryOperatorKind Op>
+QuickKernel additiveKernel(OperandKind lhs, OperandKind rhs) {
+  if (lhs == OK_Ptr)
+    return rhs == OK_Ptr ? &binaryKernel<Op, OK_Ptr, OK_Ptr>
+                         : &binaryKernel<Op, OK_Ptr, OK_Int>;
+  return rhs == OK_Ptr ? &binaryKernel<Op, OK_Int, OK_Ptr>
+                       : &binaryKernel<Op, OK_Int, OK_Int>;
+}
+
+/// The handler of binary \p op on operands of kinds \p lhs and \p rhs, null
+/// for the operators that need more than their operands' values (assignment)
+/// or that are not supported.
+inline QuickKernel selectKernel(BinaryOperatorKind op, OperandKind lhs,
+                                OperandKind rhs) {
+  switch (op) {
+  case BO_Add: return additiveKernel<BO_Add>(lhs, rhs);
+  case BO_Sub: return additiveKernel<BO_Sub>(lhs, rhs);
+  /// the others treat pointers as plain ints
+#define QUICK_INT_KERNEL(op)                                                   \
+  case op: return &binaryKernel<op, OK_Int, OK_Int>;
+  QUICK_INT_KERNEL(BO_Mul)
+  QUICK_INT_KERNEL(BO_Div)
+  QUICK_INT_KERNEL(BO_Rem)
+  QUICK_INT_KERNEL(BO_LT)
+  QUICK_INT_KERNEL(BO_GT)
+  QUICK_INT_KERNEL(BO_LE)
+  QUICK_INT_KERNEL(BO_GE)
+  QUICK_INT_KERNEL(BO_EQ)
+  QUICK_INT_KERNEL(BO_NE)
+#undef QUICK_INT_KERNEL
+  default: return nullptr;
+  }
+}
+
+/// The handler of unary \p op, null for the ones that touch memory.
+inline QuickKernel selectKernel(UnaryOperatorKind op) {
+  switch (op) {
+  case UO_Plus: return &unaryKernel<UO_Plus>;
+  case UO_Minus: return &unaryKernel<UO_Minus>;
+  case UO_Not: return &unaryKernel<UO_Not>;
+  case UO_LNot: return &unaryKernel<UO_LNot>;
+  default: return nullptr;
+  }
+}
+
+inline OperandKind operandKind(const Expr *expr) {
+  return expr->getType()->isPointerType() ? OK_Ptr : OK_Int;
+}
+
+#endif
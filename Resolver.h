@@ -0,0 +1,290 @@
+//==--- Resolver.h - Static resolution of variables to frame slots ---------==//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_RESOLVER_H
+#define AST_INTERPRETER_RESOLVER_H
+
+#include <exception>
+#include <vector>
+
+#include "clang/AST/Decl.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/STLExtras.h"
+
+#include "Memory.h"
+
+using namespace clang;
+
+/// Bytes a value of \p type takes in Memory. Values of the interpreter are
+/// ints, so every integer wider than a short is 4 bytes, like pointers.
+inline int typeSize(QualType type) {
+  if (type->isPointerType())
+    return Memory::PTR_SIZE;
+  if (const ConstantArrayType *arrayType =
+          dyn_cast_or_null<ConstantArrayType>(type->getAsArrayTypeUnsafe()))
+    return arrayType->getSize().getSExtValue() *
+           typeSize(arrayType->getElementType());
+  if (type->isCharType() || type->isBooleanType())
+    return 1;
+  if (type->isSpecificBuiltinType(BuiltinType::Short) ||
+      type->isSpecificBuiltinType(BuiltinType::UShort))
+    return 2;
+  if (type->isIntegerType())
+    return sizeof(int);
+  llvm::outs() << "Unknown Type:\n";
+  type.dump();
+  throw std::exception();
+}
+
+/// Where a variable lives: an index into the global segment or into the frame
+/// of the function declaring it. Arrays and variables whose address is taken
+/// live in Memory instead, at mOffset of the memory of that frame.
+struct VarSlot {
+  bool mGlobal;
+  bool mInMemory;
+  unsigned mIndex;
+  unsigned mOffset;
+};
+
+/// How much storage a frame of one function (or the global segment) needs:
+/// variable slots plus one temporary per node of the body, and the bytes of
+/// Memory for its variables that need an address.
+///
+/// The nodes are numbered in pre-order, the non-null `children()` of a node
+/// in order, and a node's number is the index of its temporary. The first
+/// child of node n is n + 1 and every further one follows the subtree of the
+/// one before, so the evaluators carry the number of the node they visit and
+/// find those of its children from mSubtree, without a lookup.
+struct FrameLayout {
+  unsigned mNumSlots;
+  unsigned mNumTemps;
+  unsigned mMemSize;
+  /// some parameter lives in Memory and has to be copied there on entry
+  bool mSpillParams;
+  /// 0 for the global segment, the functions follow from 1, so tables of
+  /// the evaluators can be kept per layout in a vector
+  unsigned mIndex;
+  /// nodes in the subtree of every node, itself included
+  std::vector<unsigned> mSubtree;
+  /// by node, the variable a DeclRefExpr refers to
+  std::vector<VarSlot> mRefSlots;
+  /// by node, whether it is the root of a subtree the ConstantFolder folded,
+  /// and then its value in mConstants
+  std::vector<unsigned char> mIsConstant;
+  std::vector<int> mConstants;
+
+  FrameLayout()
+      : mNumSlots(0), mNumTemps(0), mMemSize(0), mSpillParams(false),
+        mIndex(0), mSubtree(), mRefSlots(), mIsConstant(), mConstants() {}
+
+  /// the value of \p node if it is the root of a constant subtree
+  const int *constant(unsigned node) const {
+    return mIsConstant[node] ? &mConstants[node] : nullptr;
+  }
+
+  /// the node after the subtree of \p node, i.e. its next sibling
+  unsigned next(unsigned node) const { return node + mSubtree[node]; }
+
+  /// the number of \p target, a child of \p parent numbered \p node
+  unsigned childOf(const Stmt *parent, unsigned node,
+                   const Stmt *target) const {
+    unsigned num = node + 1;
+    for (const Stmt *child : parent->children()) {
+      if (child == target)
+        return num;
+      if (child)
+        num = next(num);
+    }
+    notNumbered(target);
+  }
+  /// the number of \p target, which \p stmt numbered \p node wraps in
+  /// first children only, e.g. in parentheses and implicit casts
+  static unsigned descend(const Stmt *stmt, unsigned node,
+                          const Stmt *target) {
+    while (stmt != target) {
+      const Stmt *first = nullptr;
+      for (const Stmt *child : stmt->children())
+        if ((first = child))
+          break;
+      if (!first)
+        notNumbered(target);
+      stmt = first;
+      ++node;
+    }
+    return node;
+  }
+
+  [[noreturn]] static void notNumbered(const Stmt *stmt) {
+    llvm::outs() << "We cannot find the value of below stmt:\n";
+    stmt->dump();
+    throw std::exception();
+  }
+};
+
+/// Finds the variables whose address is taken with `&`.
+class AddressTakenFinder : public RecursiveASTVisitor<AddressTakenFinder> {
+public:
+  llvm::DenseSet<const Decl *> mDecls;
+
+  bool VisitUnaryOperator(UnaryOperator *uop) {
+    if (uop->getOpcode() != UO_AddrOf)
+      return true;
+    if (DeclRefExpr *declref =
+            dyn_cast<DeclRefExpr>(uop->getSubExpr()->IgnoreParens()))
+      if (isa<VarDecl>(declref->getDecl()))
+        mDecls.insert(declref->getDecl()->getCanonicalDecl());
+    return true;
+  }
+};
+
+/// Resolver walks the translation unit once before execution and gives every
+/// VarDecl/ParmVarDecl a fixed slot, so a variable access at runtime is an
+/// array index instead of a search through the frame. The slot of every
+/// DeclRefExpr is looked up here too and kept by node (see FrameLayout).
+/// Parameters always take the first slots of their function, in order.
+/// Every node of a body is also numbered once within its function (see
+/// FrameLayout); the value of an expression is kept in that temporary of the
+/// frame. The global initializers are numbered in the global frame.
+/// Arrays and variables whose address is taken additionally get an offset in
+/// the Memory of the frame (or the global memory).
+/// `return f(...)` is marked as a tail call if nothing in the frame of the
+/// caller can be referenced by the callee, i.e. it has no Memory.
+class Resolver : public RecursiveASTVisitor<Resolver> {
+  llvm::DenseMap<const Decl *, VarSlot> mSlots;
+  llvm::DenseSet<const Decl *> mAddressTaken;
+  llvm::DenseSet<const ReturnStmt *> mTailCalls;
+  /// `return f(...)` of the function being traversed
+  std::vector<const ReturnStmt *> mReturnCalls;
+  llvm::DenseMap<const FunctionDecl *, FrameLayout> mLayouts;
+  FrameLayout mGlobalLayout;
+  /// layout of the function whose body is being traversed
+  FrameLayout *mCurrent;
+
+  void addSlot(VarDecl *vdecl, FrameLayout &layout, bool global) {
+    const Decl *key = vdecl->getCanonicalDecl();
+    /// tentative definitions of a global share one slot
+    if (mSlots.find(key) != mSlots.end())
+      return;
+    VarSlot slot{global, false, layout.mNumSlots++, 0};
+    if (vdecl->getType()->isArrayType() || mAddressTaken.count(key)) {
+      slot.mInMemory = true;
+      slot.mOffset = (layout.mMemSize + Memory::ALIGN - 1) &
+                     ~(unsigned)(Memory::ALIGN - 1);
+      layout.mMemSize = slot.mOffset + typeSize(vdecl->getType());
+      if (isa<ParmVarDecl>(vdecl))
+        layout.mSpillParams = true;
+    }
+    mSlots[key] = slot;
+  }
+
+public:
+  Resolver() : mCurrent(nullptr) {}
+
+  /// \p constantOf gives the value of the roots of the constant subtrees,
+  /// which are kept by node (see ConstantFolder)
+  void resolve(TranslationUnitDecl *unit,
+               llvm::function_ref<const int *(const Stmt *)> constantOf) {
+    AddressTakenFinder finder;
+    finder.TraverseDecl(unit);
+    mAddressTaken.swap(finder.mDecls);
+    for (TranslationUnitDecl::decl_iterator i = unit->decls_begin(),
+                                            e = unit->decls_end();
+         i != e; ++i) {
+      if (FunctionDecl *fdecl = dyn_cast<FunctionDecl>(*i)) {
+        if (!fdecl->doesThisDeclarationHaveABody())
+          continue;
+        FrameLayout &layout = mLayouts[fdecl];
+        layout.mIndex = mLayouts.size();
+        for (unsigned p = 0; p < fdecl->getNumParams(); p++)
+          addSlot(fdecl->getParamDecl(p), layout, false);
+        mCurrent = &layout;
+        mReturnCalls.clear();
+        TraverseStmt(fdecl->getBody());
+        number(fdecl->getBody(), constantOf);
+        mCurrent = nullptr;
+        if (layout.mMemSize == 0)
+          mTailCalls.insert(mReturnCalls.begin(), mReturnCalls.end());
+      } else if (VarDecl *vdecl = dyn_cast<VarDecl>(*i)) {
+        addSlot(vdecl, mGlobalLayout, true);
+        /// initializers are evaluated in the global frame
+        mCurrent = &mGlobalLayout;
+        if (vdecl->getInit()) {
+          TraverseStmt(vdecl->getInit());
+          number(vdecl->getInit(), constantOf);
+        }
+        mCurrent = nullptr;
+      }
+    }
+  }
+
+  /// locals declared anywhere in the body, including nested blocks
+  bool VisitVarDecl(VarDecl *vdecl) {
+    if (vdecl->hasGlobalStorage())
+      addSlot(vdecl, mGlobalLayout, true);
+    else
+      addSlot(vdecl, *mCurrent, false);
+    return true;
+  }
+
+  bool VisitReturnStmt(ReturnStmt *retstmt) {
+    if (callOf(retstmt))
+      mReturnCalls.push_back(retstmt);
+    return true;
+  }
+
+  /// number \p stmt and its subtree with the next nodes of mCurrent; the
+  /// variables are resolved already
+  void number(Stmt *stmt,
+              llvm::function_ref<const int *(const Stmt *)> constantOf) {
+    unsigned node = mCurrent->mNumTemps++;
+    mCurrent->mSubtree.push_back(0);
+    mCurrent->mRefSlots.push_back(VarSlot());
+    const int *value = constantOf(stmt);
+    mCurrent->mIsConstant.push_back(value != nullptr);
+    mCurrent->mConstants.push_back(value ? *value : 0);
+    if (DeclRefExpr *declref = dyn_cast<DeclRefExpr>(stmt))
+      if (isa<VarDecl>(declref->getDecl()))
+        mCurrent->mRefSlots[node] = getSlot(declref->getDecl());
+    for (Stmt *child : stmt->children())
+      if (child)
+        number(child, constantOf);
+    mCurrent->mSubtree[node] = mCurrent->mNumTemps - node;
+  }
+
+  /// the call to a function with a body that \p retstmt returns, if any
+  static CallExpr *callOf(ReturnStmt *retstmt) {
+    Expr *value = retstmt->getRetValue();
+    if (!value)
+      return nullptr;
+    CallExpr *call = dyn_cast<CallExpr>(value->IgnoreParenImpCasts());
+    if (!call || !call->getDirectCallee() ||
+        !call->getDirectCallee()->getDefinition())
+      return nullptr;
+    return call;
+  }
+
+  /// the callee may take over the frame of \p retstmt's function
+  bool isTailCall(const ReturnStmt *retstmt) const {
+    return mTailCalls.count(retstmt);
+  }
+
+  VarSlot getSlot(const Decl *decl) const {
+    auto it = mSlots.find(decl->getCanonicalDecl());
+    assert(it != mSlots.end() && "variable was not resolved");
+    return it->second;
+  }
+
+  /// \p fdecl may be any redeclaration; the layout belongs to the definition
+  const FrameLayout &getLayout(const FunctionDecl *fdecl) const {
+    auto it = mLayouts.find(fdecl->getDefinition());
+    assert(it != mLayouts.end() && "function has no body");
+    return it->second;
+  }
+
+  const FrameLayout &getGlobalLayout() const { return mGlobalLayout; }
+  /// the layouts have the indices [0, getNumLayouts())
+  unsigned getNumLayouts() const { return mLayouts.size() + 1; }
+};
+
+#endif
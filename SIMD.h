@@ -0,0 +1,180 @@
+//==--- SIMD.h - Vectorized kernels of the loop idioms ---------------------==//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_SIMD_H
+#define AST_INTERPRETER_SIMD_H
+
+#include <cstddef>
+#include <cstring>
+
+#if defined(__x86_64__)
+#define ASTI_SIMD_X86 1
+#include <immintrin.h>
+#else
+#define ASTI_SIMD_X86 0
+#endif
+
+/// The kernels behind LoopIdiom (LoopIdiom.h), over ints at arbitrary,
+/// possibly unaligned, addresses of Memory. Every kernel has a scalar
+/// version; on x86-64 an SSE2 one (always there) and an AVX2 one, compiled
+/// with a target attribute so the rest of the interpreter does not need
+/// -mavx2. simdKernels() picks the widest the CPU supports, once.
+struct SIMDKernels {
+  /// p[0, n) = val
+  void (*mFill)(char *p, size_t n, int val);
+  /// p[0, n) summed with wrap-around
+  int (*mSum)(const char *p, size_t n);
+  /// the first k < n with (p[k] == q[k]) == equal, n if none
+  size_t (*mFind)(const char *p, const char *q, size_t n, bool equal);
+  /// the first k < n with (p[k] == val) == equal, n if none
+  size_t (*mFindValue)(const char *p, size_t n, int val, bool equal);
+  const char *mName;
+};
+
+inline int simdLoad(const char *p) {
+  int val;
+  memcpy(&val, p, sizeof(int));
+  return val;
+}
+
+inline void scalarFill(char *p, size_t n, int val) {
+  for (size_t i = 0; i < n; i++)
+    memcpy(p + i * sizeof(int), &val, sizeof(int));
+}
+inline int scalarSum(const char *p, size_t n) {
+  unsigned sum = 0;
+  for (size_t i = 0; i < n; i++)
+    sum += (unsigned)simdLoad(p + i * sizeof(int));
+  return (int)sum;
+}
+inline size_t scalarFind(const char *p, const char *q, size_t n, bool equal) {
+  for (size_t i = 0; i < n; i++)
+    if ((simdLoad(p + i * sizeof(int)) == simdLoad(q + i * sizeof(int))) ==
+        equal)
+      return i;
+  return n;
+}
+inline size_t scalarFindValue(const char *p, size_t n, int val, bool equal) {
+  for (size_t i = 0; i < n; i++)
+    if ((simdLoad(p + i * sizeof(int)) == val) == equal)
+      return i;
+  return n;
+}
+
+#if ASTI_SIMD_X86
+/// lanes whose comparison is `equal` in the \p lanes low bits of \p mask
+inline unsigned simdHits(unsigned mask, unsigned lanes, bool equal) {
+  return (equal ? mask : ~mask) & ((1u << lanes) - 1);
+}
+
+inline void sse2Fill(char *p, size_t n, int val) {
+  __m128i v = _mm_set1_epi32(val);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm_storeu_si128((__m128i *)(p + i * sizeof(int)), v);
+  scalarFill(p + i * sizeof(int), n - i, val);
+}
+inline int sse2Sum(const char *p, size_t n) {
+  __m128i acc = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    acc = _mm_add_epi32(
+        acc, _mm_loadu_si128((const __m128i *)(p + i * sizeof(int))));
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0x4E));
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0xB1));
+  return (int)((unsigned)_mm_cvtsi128_si32(acc) +
+               (unsigned)scalarSum(p + i * sizeof(int), n - i));
+}
+inline size_t sse2Find(const char *p, const char *q, size_t n, bool equal) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(p + i * sizeof(int)));
+    __m128i b = _mm_loadu_si128((const __m128i *)(q + i * sizeof(int)));
+    unsigned mask =
+        _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a, b)));
+    if (unsigned hits = simdHits(mask, 4, equal))
+      return i + __builtin_ctz(hits);
+  }
+  return i + scalarFind(p + i * sizeof(int), q + i * sizeof(int), n - i,
+                        equal);
+}
+inline size_t sse2FindValue(const char *p, size_t n, int val, bool equal) {
+  __m128i v = _mm_set1_epi32(val);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(p + i * sizeof(int)));
+    unsigned mask =
+        _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a, v)));
+    if (unsigned hits = simdHits(mask, 4, equal))
+      return i + __builtin_ctz(hits);
+  }
+  return i + scalarFindValue(p + i * sizeof(int), n - i, val, equal);
+}
+
+#define ASTI_AVX2 __attribute__((target("avx2")))
+ASTI_AVX2 inline void avx2Fill(char *p, size_t n, int val) {
+  __m256i v = _mm256_set1_epi32(val);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+    _mm256_storeu_si256((__m256i *)(p + i * sizeof(int)), v);
+  sse2Fill(p + i * sizeof(int), n - i, val);
+}
+ASTI_AVX2 inline int avx2Sum(const char *p, size_t n) {
+  __m256i acc = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+    acc = _mm256_add_epi32(
+        acc, _mm256_loadu_si256((const __m256i *)(p + i * sizeof(int))));
+  __m128i half = _mm_add_epi32(_mm256_castsi256_si128(acc),
+                               _mm256_extracti128_si256(acc, 1));
+  half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0x4E));
+  half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0xB1));
+  return (int)((unsigned)_mm_cvtsi128_si32(half) +
+               (unsigned)sse2Sum(p + i * sizeof(int), n - i));
+}
+ASTI_AVX2 inline size_t avx2Find(const char *p, const char *q, size_t n,
+                                 bool equal) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(p + i * sizeof(int)));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(q + i * sizeof(int)));
+    unsigned mask =
+        _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(a, b)));
+    if (unsigned hits = simdHits(mask, 8, equal))
+      return i + __builtin_ctz(hits);
+  }
+  return i + sse2Find(p + i * sizeof(int), q + i * sizeof(int), n - i,
+                      equal);
+}
+ASTI_AVX2 inline size_t avx2FindValue(const char *p, size_t n, int val,
+                                      bool equal) {
+  __m256i v = _mm256_set1_epi32(val);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(p + i * sizeof(int)));
+    unsigned mask =
+        _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(a, v)));
+    if (unsigned hits = simdHits(mask, 8, equal))
+      return i + __builtin_ctz(hits);
+  }
+  return i + sse2FindValue(p + i * sizeof(int), n - i, val, equal);
+}
+#undef ASTI_AVX2
+#endif
+
+/// the kernels for this CPU
+inline const SIMDKernels &simdKernels() {
+  static const SIMDKernels kernels = [] {
+#if ASTI_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+      return SIMDKernels{avx2Fill, avx2Sum, avx2Find, avx2FindValue, "avx2"};
+    return SIMDKernels{sse2Fill, sse2Sum, sse2Find, sse2FindValue, "sse2"};
+#else
+    return SIMDKernels{scalarFill, scalarSum, scalarFind, scalarFindValue,
+                       "scalar"};
+#endif
+  }();
+  return kernels;
+}
+
+#endif
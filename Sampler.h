@@ -0,0 +1,264 @@
+//==--- Sampler.h - Sampling profiler of the interpreted program (--sample) -==//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_SAMPLER_H
+#define AST_INTERPRETER_SAMPLER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <map>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "clang/AST/Decl.h"
+#include "clang/AST/Stmt.h"
+#include "clang/Basic/SourceManager.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "Environment.h"
+
+using namespace clang;
+
+/// Samples the interpreted call stack: every SIGPROF (`ITIMER_PROF`, i.e.
+/// every interval of CPU time) the signal handler copies the function and PC
+/// of the innermost frames of the Environment into a ring buffer. A thread
+/// with SIGPROF blocked empties the ring into counts per distinct stack, and
+/// the stacks are mapped to source lines only when the report is printed.
+///
+/// The handler takes no locks and allocates nothing: the ring has one
+/// producer (the handler) and one consumer (the thread), and a sample is
+/// dropped if the ring is full or the Environment is pushing or popping a
+/// frame. The interpreter only pays for marking frame pushes and pops.
+class Sampler {
+public:
+  /// innermost frames kept per sample
+  static const unsigned MAX_DEPTH = 32;
+  /// samples the ring holds, a power of two
+  static const unsigned RING_SIZE = 4096;
+
+private:
+  typedef std::pair<const FunctionDecl *, const Stmt *> Frame;
+  /// frames innermost first
+  typedef std::vector<Frame> Stack;
+
+  struct Sample {
+    unsigned mDepth;
+    /// the stack had more than MAX_DEPTH frames
+    bool mTruncated;
+    Frame mFrames[MAX_DEPTH];
+  };
+
+  const Environment &mEnv;
+  const SourceManager &mSources;
+  unsigned mIntervalUs;
+
+  std::vector<Sample> mRing;
+  /// next sample the handler writes, only written by the handler
+  std::atomic<unsigned> mHead;
+  /// next sample the thread reads, only written by the thread
+  std::atomic<unsigned> mTail;
+  std::atomic<unsigned long> mDropped;
+
+  std::thread mDrainer;
+  std::atomic<bool> mStopping;
+  bool mRunning;
+  struct sigaction mOldAction;
+
+  /// samples per distinct stack; only touched by the drainer, and by the
+  /// report once it has stopped
+  std::map<std::pair<Stack, bool>, unsigned long> mStacks;
+  unsigned long mSamples;
+
+  /// the Sampler SIGPROF is delivered to
+  static Sampler *&active() {
+    static Sampler *sampler = nullptr;
+    return sampler;
+  }
+
+  static void onSignal(int) {
+    int savedErrno = errno;
+    if (Sampler *sampler = active())
+      sampler->record();
+    errno = savedErrno;
+  }
+
+  /// runs in the signal handler
+  void record() {
+    if (mEnv.isStackChanging()) {
+      mDropped++;
+      return;
+    }
+    unsigned head = mHead.load(std::memory_order_relaxed);
+    if (head - mTail.load(std::memory_order_acquire) == RING_SIZE) {
+      mDropped++;
+      return;
+    }
+    Sample &sample = mRing[head & (RING_SIZE - 1)];
+    const std::vector<StackFrame> &stack = mEnv.getStack();
+    /// frame 0 is the global frame
+    size_t depth = stack.empty() ? 0 : stack.size() - 1;
+    sample.mDepth = std::min<size_t>(depth, MAX_DEPTH);
+    sample.mTruncated = depth > MAX_DEPTH;
+    for (unsigned i = 0; i < sample.mDepth; i++) {
+      const StackFrame &frame = stack[stack.size() - 1 - i];
+      sample.mFrames[i] = Frame(frame.getFunction(), frame.getPC());
+    }
+    mHead.store(head + 1, std::memory_order_release);
+  }
+
+  /// moves the samples out of the ring into mStacks
+  void drain() {
+    unsigned tail = mTail.load(std::memory_order_relaxed);
+    unsigned head = mHead.load(std::memory_order_acquire);
+    for (; tail != head; tail++) {
+      const Sample &sample = mRing[tail & (RING_SIZE - 1)];
+      Stack stack(sample.mFrames, sample.mFrames + sample.mDepth);
+      mStacks[std::make_pair(stack, sample.mTruncated)]++;
+      mSamples++;
+    }
+    mTail.store(tail, std::memory_order_release);
+  }
+
+  void drainLoop() {
+    while (!mStopping.load()) {
+      drain();
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  }
+
+  unsigned lineOf(const Frame &frame) const {
+    SourceLocation loc = frame.second ? frame.second->getBeginLoc()
+                                      : frame.first->getLocation();
+    return loc.isValid() ? mSources.getPresumedLineNumber(loc) : 0;
+  }
+
+  template <typename Key>
+  static std::vector<std::pair<Key, unsigned long>>
+  top(const std::map<Key, unsigned long> &counts, unsigned n) {
+    std::vector<std::pair<Key, unsigned long>> sorted(counts.begin(),
+                                                      counts.end());
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [](const std::pair<Key, unsigned long> &a,
+                        const std::pair<Key, unsigned long> &b) {
+                       return a.second > b.second;
+                     });
+    if (sorted.size() > n)
+      sorted.resize(n);
+    return sorted;
+  }
+
+public:
+  Sampler(const Environment &env, const SourceManager &sources,
+          unsigned intervalUs)
+      : mEnv(env), mSources(sources), mIntervalUs(intervalUs),
+        mRing(RING_SIZE), mHead(0), mTail(0), mDropped(0), mStopping(false),
+        mRunning(false), mSamples(0) {}
+
+  ~Sampler() { stop(); }
+
+  /// only one Sampler can run at a time, SIGPROF is process wide
+  void start() {
+    if (mRunning || active())
+      return;
+    active() = this;
+    struct sigaction action;
+    action.sa_handler = onSignal;
+    sigemptyset(&action.sa_mask);
+    /// GET and PRINT must not see EINTR
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGPROF, &action, &mOldAction);
+
+    /// the drainer inherits the blocked SIGPROF, so the handler always
+    /// interrupts the interpreter
+    sigset_t prof, old;
+    sigemptyset(&prof);
+    sigaddset(&prof, SIGPROF);
+    pthread_sigmask(SIG_BLOCK, &prof, &old);
+    mStopping = false;
+    mDrainer = std::thread(&Sampler::drainLoop, this);
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+
+    struct itimerval timer;
+    timer.it_interval.tv_sec = mIntervalUs / 1000000;
+    timer.it_interval.tv_usec = mIntervalUs % 1000000;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    mRunning = true;
+  }
+
+  void stop() {
+    if (!mRunning)
+      return;
+    struct itimerval timer = {};
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    sigaction(SIGPROF, &mOldAction, nullptr);
+    active() = nullptr;
+    mStopping = true;
+    mDrainer.join();
+    drain();
+    mRunning = false;
+  }
+
+  /// the \p n lines with the most samples in the innermost frame, and the
+  /// \p n functions with the most samples anywhere on the stack
+  void printSummary(llvm::raw_ostream &os, unsigned n) const {
+    std::map<std::pair<const FunctionDecl *, unsigned>, unsigned long> lines;
+    std::map<const FunctionDecl *, unsigned long> functions;
+    for (const auto &item : mStacks) {
+      const Stack &stack = item.first.first;
+      if (stack.empty())
+        continue;
+      lines[std::make_pair(stack[0].first, lineOf(stack[0]))] += item.second;
+      /// a recursive function counts once per sample
+      std::vector<const FunctionDecl *> seen;
+      for (const Frame &frame : stack) {
+        if (std::find(seen.begin(), seen.end(), frame.first) != seen.end())
+          continue;
+        seen.push_back(frame.first);
+        functions[frame.first] += item.second;
+      }
+    }
+
+    os << "sample: " << mSamples << " samples every " << mIntervalUs
+       << " us of CPU time, " << mDropped.load() << " dropped\n";
+    double total = mSamples ? mSamples : 1;
+    os << "sample: lines by self samples\n";
+    os << "     samples       %  function:line\n";
+    for (const auto &item : top(lines, n))
+      os << llvm::format("%12lu %7.2f  ", item.second,
+                         item.second * 100 / total)
+         << item.first.first->getNameAsString() << ":" << item.first.second
+         << "\n";
+    os << "sample: functions by total samples\n";
+    os << "     samples       %  function\n";
+    for (const auto &item : top(functions, n))
+      os << llvm::format("%12lu %7.2f  ", item.second,
+                         item.second * 100 / total)
+         << item.first->getNameAsString() << "\n";
+  }
+
+  /// one line `main:12;fib:5 <samples>` per distinct stack, for
+  /// flamegraph.pl; stacks deeper than MAX_DEPTH start with `...`
+  void printCollapsedStacks(llvm::raw_ostream &os) const {
+    for (const auto &item : mStacks) {
+      const Stack &stack = item.first.first;
+      if (stack.empty())
+        continue;
+      if (item.first.second)
+        os << "...;";
+      for (auto it = stack.rbegin(); it != stack.rend(); ++it)
+        os << (it == stack.rbegin() ? "" : ";")
+           << it->first->getNameAsString() << ":" << lineOf(*it);
+      os << " " << item.second << "\n";
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,146 @@
+//==--- Snapshot.h - State of a program after its global initializers ------==//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_SNAPSHOT_H
+#define AST_INTERPRETER_SNAPSHOT_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "Heap.h"
+
+/// InitImage is what Environment::init leaves behind once the global
+/// initializers ran: the global slots, the bytes of the global variables in
+/// Memory, the heap and the nodes `--stats` counted so far. An Environment
+/// of the same program that restores it starts right at `main`.
+///
+/// Pointers are Memory addresses, not host addresses, so an image is just
+/// bytes: it can be copied into another Environment of the process or saved
+/// to a file and loaded by another process.
+struct InitImage {
+  /// false if the initializers did something a restore cannot repeat (GET,
+  /// PRINT or a `--native` call); the initializers then run every time
+  bool mValid;
+  unsigned long long mNodes;
+  std::vector<int> mGlobalSlots;
+  std::string mGlobals;
+  Heap::State mHeap;
+  std::string mHeapBytes;
+
+  InitImage()
+      : mValid(false), mNodes(0), mGlobalSlots(), mGlobals(), mHeap(),
+        mHeapBytes() {}
+
+  /// write the image to \p path, through a temporary file so concurrent
+  /// runs never see half an image
+  bool save(const std::string &path) const {
+    llvm::Expected<llvm::sys::fs::TempFile> temp =
+        llvm::sys::fs::TempFile::create(path + "-%%%%%%%%.tmp");
+    if (!temp) {
+      llvm::consumeError(temp.takeError());
+      return false;
+    }
+    bool written;
+    {
+      llvm::raw_fd_ostream os(temp->FD, false);
+      os << magic();
+      put(os, (uint32_t)mValid);
+      put(os, (uint64_t)mNodes);
+      putVector(os, mGlobalSlots);
+      putBytes(os, mGlobals);
+      put(os, mHeap.mTop);
+      putVector(os, mHeap.mSmallFree);
+      putVector(os, mHeap.mLargeFree);
+      putBytes(os, mHeapBytes);
+      os.flush();
+      written = !os.has_error();
+      os.clear_error();
+    }
+    if (!written) {
+      llvm::consumeError(temp->discard());
+      return false;
+    }
+    if (llvm::Error err = temp->keep(path)) {
+      llvm::consumeError(std::move(err));
+      return false;
+    }
+    return true;
+  }
+
+  /// read the image saved at \p path; false if there is none or it was not
+  /// saved by this build
+  bool load(const std::string &path) {
+    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+        llvm::MemoryBuffer::getFile(path);
+    if (!buffer)
+      return false;
+    llvm::StringRef data = (*buffer)->getBuffer();
+    if (!data.consume_front(magic()))
+      return false;
+    uint32_t valid;
+    uint64_t nodes;
+    if (!get(data, valid) || !get(data, nodes) ||
+        !getVector(data, mGlobalSlots) || !getBytes(data, mGlobals) ||
+        !get(data, mHeap.mTop) || !getVector(data, mHeap.mSmallFree) ||
+        !getVector(data, mHeap.mLargeFree) || !getBytes(data, mHeapBytes) ||
+        !data.empty())
+      return false;
+    mValid = valid;
+    mNodes = nodes;
+    return true;
+  }
+
+private:
+  /// changes with the layout of the file or of Memory
+  static llvm::StringRef magic() { return "asti-init-1\n"; }
+
+  /// integers are saved in the byte order of the host, an image is only
+  /// ever loaded where it was made
+  template <typename T> static void put(llvm::raw_ostream &os, const T &val) {
+    os.write((const char *)&val, sizeof(T));
+  }
+  template <typename T>
+  static void putVector(llvm::raw_ostream &os, const std::vector<T> &vec) {
+    put(os, (uint64_t)vec.size());
+    os.write((const char *)vec.data(), vec.size() * sizeof(T));
+  }
+  static void putBytes(llvm::raw_ostream &os, llvm::StringRef bytes) {
+    put(os, (uint64_t)bytes.size());
+    os << bytes;
+  }
+
+  template <typename T> static bool get(llvm::StringRef &data, T &val) {
+    if (data.size() < sizeof(T))
+      return false;
+    memcpy(&val, data.data(), sizeof(T));
+    data = data.drop_front(sizeof(T));
+    return true;
+  }
+  template <typename T>
+  static bool getVector(llvm::StringRef &data, std::vector<T> &vec) {
+    uint64_t size;
+    if (!get(data, size) || size > data.size() / sizeof(T))
+      return false;
+    vec.resize(size);
+    memcpy(vec.data(), data.data(), size * sizeof(T));
+    data = data.drop_front(size * sizeof(T));
+    return true;
+  }
+  static bool getBytes(llvm::StringRef &data, std::string &bytes) {
+    uint64_t size;
+    if (!get(data, size) || size > data.size())
+      return false;
+    bytes = data.take_front(size).str();
+    data = data.drop_front(size);
+    return true;
+  }
+};
+
+#endif
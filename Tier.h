@@ -0,0 +1,136 @@
+//==--- Tier.h - Promotion of hot walker code to the bytecode engine -------==//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_TIER_H
+#define AST_INTERPRETER_TIER_H
+
+#include <climits>
+#include <vector>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "BytecodeVM.h"
+
+/// Tiering counts the calls of every function and the back-edges of every
+/// loop the AST walker runs. Code that crosses the threshold is promoted to
+/// the bytecode engine:
+///
+/// - a hot function: its later calls run as bytecode (hotCall/call)
+/// - a hot loop: the rest of the function it is running in continues as
+///   bytecode from the condition of the loop (hotLoop/resume), so a long
+///   loop in `main` is promoted without waiting for another call
+///
+/// Code that runs only a few times, like the global initializers, stays with
+/// the walker. A function is promoted only if it and everything it can call
+/// compile to bytecode, otherwise it stays with the walker for good.
+class Tiering {
+  /// counter value of code that cannot be promoted
+  static const unsigned NEVER = UINT_MAX;
+
+  Environment &mEnv;
+  BytecodeVM mVM;
+  unsigned mThreshold;
+  /// calls of each function so far, mThreshold once it is promoted
+  llvm::DenseMap<const FunctionDecl *, unsigned> mCalls;
+  /// back-edges of each loop so far
+  llvm::DenseMap<const Stmt *, unsigned> mBackEdges;
+  /// whether each function and its callees compile to bytecode
+  llvm::DenseMap<const FunctionDecl *, bool> mCompilable;
+  /// functions of the module that do not compile
+  llvm::DenseSet<unsigned> mFailed;
+  /// tier-up events for `--stats`
+  unsigned mPromoted;
+  unsigned mReplaced;
+
+  /// compile \p fdecl and every function it calls, transitively, so the
+  /// bytecode engine cannot fail on a callee in the middle of a call
+  bool compile(FunctionDecl *fdecl) {
+    auto known = mCompilable.find(fdecl);
+    if (known != mCompilable.end())
+      return known->second;
+    BytecodeModule &module = mVM.getModule();
+    std::vector<unsigned> closure{module.indexOf(fdecl)};
+    llvm::DenseSet<unsigned> seen;
+    seen.insert(closure[0]);
+    bool ok = true;
+    for (size_t i = 0; ok && i < closure.size(); i++) {
+      if (mFailed.count(closure[i])) {
+        ok = false;
+        break;
+      }
+      try {
+        BCFunction &fn = compiledFunction(mEnv, module, closure[i], false);
+        for (const Instr &instr : fn.mCode)
+          if ((instr.mOp == OP_Call || instr.mOp == OP_TailCall) &&
+              seen.insert(instr.mB).second)
+            closure.push_back(instr.mB);
+      } catch (std::exception &) {
+        mFailed.insert(closure[i]);
+        ok = false;
+      }
+    }
+    if (!ok)
+      ASTI_TRACE(TL_Info, fdecl->getName()
+                              << " stays with the walker, it does not "
+                                 "compile to bytecode\n");
+    mCompilable[fdecl] = ok;
+    return ok;
+  }
+
+public:
+  /// \p threshold calls or back-edges make a function or loop hot
+  Tiering(Environment &env, unsigned threshold)
+      : mEnv(env), mVM(env), mThreshold(threshold), mCalls(), mBackEdges(),
+        mCompilable(), mFailed(), mPromoted(0), mReplaced(0) {}
+
+  /// Count a call of \p callee (a definition); true if the call has to go
+  /// through call() because callee runs as bytecode.
+  bool hotCall(FunctionDecl *callee) {
+    unsigned &count = mCalls[callee];
+    if (count >= mThreshold)
+      return count != NEVER;
+    if (++count < mThreshold)
+      return false;
+    if (!compile(callee)) {
+      count = NEVER;
+      return false;
+    }
+    ++mPromoted;
+    ASTI_TRACE(TL_Info, "tier-up " << callee->getName() << " after "
+                                   << mThreshold << " calls\n");
+    return true;
+  }
+  int call(FunctionDecl *callee, const int *args) {
+    return mVM.call(callee, args);
+  }
+
+  /// Count a back-edge of \p loop running in \p frame; true if the rest of
+  /// the function has to continue with resume().
+  bool hotLoop(const Stmt *loop, StackFrame &frame) {
+    unsigned &count = mBackEdges[loop];
+    if (count == NEVER || ++count < mThreshold)
+      return false;
+    FunctionDecl *fdecl = frame.getFunction();
+    if (!fdecl || !compile(fdecl)) {
+      count = NEVER;
+      return false;
+    }
+    /// the next time the function runs this loop, it starts counting anew
+    count = 0;
+    ++mReplaced;
+    ASTI_TRACE(TL_Info, "on-stack replacement of " << fdecl->getName()
+                                                   << " after " << mThreshold
+                                                   << " iterations\n");
+    return true;
+  }
+  int resume(const Stmt *loop, StackFrame &frame) {
+    return mVM.resume(frame.getFunction(), loop, frame);
+  }
+
+  void printStats(llvm::raw_ostream &os) const {
+    os << "stats: tier-ups=" << mPromoted << " osr=" << mReplaced << "\n";
+  }
+};
+
+#endif
@@ -0,0 +1,33 @@
+//==--- Trace.h - Diagnostic output of the interpreter ---------------------==//
+//===----------------------------------------------------------------------===//
+#ifndef AST_INTERPRETER_TRACE_H
+#define AST_INTERPRETER_TRACE_H
+
+#include "llvm/Support/raw_ostream.h"
+
+/// How much the interpreter reports about itself (on stdout, never mixed
+/// with the PRINT output of the program on stderr).
+/// - TL_Info: one-off events, e.g. a function compiled to bytecode
+/// - TL_Trace: every heap store, allocation, global store, ...
+enum TraceLevel { TL_Off = 0, TL_Info = 1, TL_Trace = 2 };
+
+/// The highest level compiled in, set by the ASTI_TRACE CMake option.
+/// Statements above it are constant-false and removed by the compiler.
+#ifndef ASTI_MAX_TRACE_LEVEL
+#define ASTI_MAX_TRACE_LEVEL 0
+#endif
+
+/// The level chosen at run time with --trace=...
+inline TraceLevel &traceLevel() {
+  static TraceLevel level = TL_Off;
+  return level;
+}
+
+/// ASTI_TRACE(TL_Trace, "Update *" << addr << " -> " << val << "\n");
+#define ASTI_TRACE(level, msg)                                                 \
+  do {                                                                         \
+    if ((level) <= ASTI_MAX_TRACE_LEVEL && (level) <= traceLevel())            \
+      llvm::outs() << msg;                                                     \
+  } while (0)
+
+#endif
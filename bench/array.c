@@ -0,0 +1,24 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+/* array scans: scale * 1000 passes over 1000 ints */
+int a[1000];
+
+int main() {
+   int n = GET() * 1000;
+   int s = 0;
+   int i;
+   int k;
+   for (i = 0; i < 1000; i = i + 1)
+      a[i] = i;
+   for (k = 0; k < n; k = k + 1) {
+      for (i = 0; i < 1000; i = i + 1)
+         s = s + a[i];
+      s = s % 1000003;
+      a[k % 1000] = s;
+   }
+   PRINT(s);
+   return 0;
+}
@@ -0,0 +1,27 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+/* many small calls: scale * 500000 calls of three leaf functions */
+int add(int a, int b) {
+   return a + b;
+}
+
+int mix(int a, int b) {
+   return (a * 31 + b) % 1000003;
+}
+
+int step(int s, int i) {
+   return mix(add(s, i), i);
+}
+
+int main() {
+   int n = GET() * 500000;
+   int s = 0;
+   int i;
+   for (i = 0; i < n; i = i + 1)
+      s = step(s, i);
+   PRINT(s);
+   return 0;
+}
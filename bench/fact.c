@@ -0,0 +1,21 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+/* recursive factorial: scale * 20000 calls of fact(12) */
+int fact(int n) {
+   if (n < 2)
+      return 1;
+   return n * fact(n - 1);
+}
+
+int main() {
+   int n = GET() * 20000;
+   int s = 0;
+   int i;
+   for (i = 0; i < n; i = i + 1)
+      s = (s + fact(12) % 1000) % 1000003;
+   PRINT(s);
+   return 0;
+}
@@ -0,0 +1,21 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+/* recursive fib: scale calls of fib(20) */
+int fib(int n) {
+   if (n < 2)
+      return n;
+   return fib(n - 1) + fib(n - 2);
+}
+
+int main() {
+   int n = GET();
+   int s = 0;
+   int i;
+   for (i = 0; i < n; i = i + 1)
+      s = (s + fib(20)) % 1000003;
+   PRINT(s);
+   return 0;
+}
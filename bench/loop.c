@@ -0,0 +1,17 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+/* tight for loops: scale * 1000000 iterations */
+int main() {
+   int n = GET() * 1000;
+   int s = 0;
+   int i;
+   int j;
+   for (i = 0; i < n; i = i + 1)
+      for (j = 0; j < 1000; j = j + 1)
+         s = (s + i * j) % 1000003;
+   PRINT(s);
+   return 0;
+}
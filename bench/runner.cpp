@@ -0,0 +1,235 @@
+//==--- runner.cpp - Timing harness of the bench/ workloads -----------------==//
+//===----------------------------------------------------------------------===//
+//
+// Runs every workload in a fresh ast-interpreter process, a few times to warm
+// up and then `--reps` times for real, and prints one JSON object with the
+// median wall time, the nodes per second (from `--stats`) and the peak RSS of
+// each workload:
+//
+//   asti-bench --interpreter=./ast-interpreter --scale=4 --flag=--bytecode
+//       ../bench/*.c
+//
+// The workloads read their scale with GET(), so the work grows linearly with
+// `--scale`. Their PRINT output is discarded.
+//
+//===----------------------------------------------------------------------===//
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/// What one process of a workload took.
+struct Sample {
+  double mSeconds;
+  long mMaxRSS;
+  unsigned long long mNodes;
+};
+
+struct Options {
+  std::string mInterpreter;
+  std::vector<std::string> mFlags;
+  int mScale;
+  int mReps;
+  int mWarmup;
+  std::string mOut;
+
+  Options()
+      : mInterpreter("./ast-interpreter"), mScale(1), mReps(5), mWarmup(1) {}
+};
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static std::string quote(const std::string &str) {
+  std::string res = "\"";
+  for (char c : str) {
+    if (c == '"' || c == '\\')
+      res += '\\';
+    if ((unsigned char)c < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      res += buf;
+    } else {
+      res += c;
+    }
+  }
+  return res + "\"";
+}
+
+/// Runs \p file once; false if the interpreter did not exit with 0.
+static bool runOnce(const Options &options, const std::string &file,
+                    Sample &sample) {
+  int in[2], out[2];
+  if (pipe(in) || pipe(out)) {
+    perror("pipe");
+    return false;
+  }
+  std::vector<std::string> args;
+  args.push_back(options.mInterpreter);
+  args.insert(args.end(), options.mFlags.begin(), options.mFlags.end());
+  args.push_back("--stats");
+  args.push_back("--file=" + file);
+  std::vector<char *> argv;
+  for (std::string &arg : args)
+    argv.push_back(&arg[0]);
+  argv.push_back(nullptr);
+
+  double start = now();
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return false;
+  }
+  if (pid == 0) {
+    int null = open("/dev/null", O_WRONLY);
+    dup2(in[0], 0);
+    dup2(out[1], 1);
+    dup2(null, 2);
+    close(in[0]);
+    close(in[1]);
+    close(out[0]);
+    close(out[1]);
+    execv(argv[0], argv.data());
+    _exit(127);
+  }
+  close(in[0]);
+  close(out[1]);
+  std::string scale = std::to_string(options.mScale) + "\n";
+  if (write(in[1], scale.data(), scale.size()) < 0)
+    perror("write");
+  close(in[1]);
+
+  std::string stats;
+  char buf[4096];
+  ssize_t n;
+  while ((n = read(out[0], buf, sizeof(buf))) > 0)
+    stats.append(buf, n);
+  close(out[0]);
+
+  int status;
+  struct rusage usage;
+  if (wait4(pid, &status, 0, &usage) < 0) {
+    perror("wait4");
+    return false;
+  }
+  sample.mSeconds = now() - start;
+  sample.mMaxRSS = usage.ru_maxrss;
+  size_t pos = stats.rfind("nodes=");
+  sample.mNodes =
+      pos == std::string::npos ? 0 : strtoull(&stats[pos + 6], nullptr, 10);
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/// The JSON object of one workload.
+static std::string bench(const Options &options, const std::string &file) {
+  std::string name = file.substr(file.rfind('/') + 1);
+  name = name.substr(0, name.rfind('.'));
+  std::string json = "{\"name\": " + quote(name);
+  Sample sample;
+  for (int i = 0; i < options.mWarmup; i++)
+    if (!runOnce(options, file, sample))
+      return json + ", \"error\": true}";
+
+  std::vector<double> times;
+  long maxRSS = 0;
+  for (int i = 0; i < options.mReps; i++) {
+    if (!runOnce(options, file, sample))
+      return json + ", \"error\": true}";
+    times.push_back(sample.mSeconds);
+    maxRSS = std::max(maxRSS, sample.mMaxRSS);
+  }
+  std::sort(times.begin(), times.end());
+  size_t mid = times.size() / 2;
+  double median = times.size() % 2 ? times[mid]
+                                    : (times[mid - 1] + times[mid]) / 2;
+
+  char buf[256];
+  snprintf(buf, sizeof(buf),
+           ", \"median_sec\": %.6f, \"min_sec\": %.6f, \"max_sec\": %.6f"
+           ", \"nodes\": %llu, \"nodes_per_sec\": %.0f, \"peak_rss_kb\": %ld}",
+           median, times.front(), times.back(), sample.mNodes,
+           median > 0 ? sample.mNodes / median : 0.0, maxRSS);
+  return json + buf;
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: asti-bench [--interpreter=<path>] [--scale=<n>] "
+          "[--reps=<n>]\n"
+          "                  [--warmup=<n>] [--flag=<interpreter flag>]... "
+          "[--out=<file>]\n"
+          "                  <workload.c>...\n");
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg.compare(0, 14, "--interpreter=") == 0) {
+      options.mInterpreter = arg.substr(14);
+    } else if (arg.compare(0, 8, "--scale=") == 0) {
+      options.mScale = atoi(arg.c_str() + 8);
+    } else if (arg.compare(0, 7, "--reps=") == 0) {
+      options.mReps = atoi(arg.c_str() + 7);
+    } else if (arg.compare(0, 9, "--warmup=") == 0) {
+      options.mWarmup = atoi(arg.c_str() + 9);
+    } else if (arg.compare(0, 7, "--flag=") == 0) {
+      /// an empty flag (e.g. an unset BENCH_FLAGS) passes nothing
+      if (arg.size() > 7)
+        options.mFlags.push_back(arg.substr(7));
+    } else if (arg.compare(0, 6, "--out=") == 0) {
+      options.mOut = arg.substr(6);
+    } else if (arg.compare(0, 2, "--") == 0) {
+      usage();
+      return 2;
+    } else {
+      files.push_back(arg);
+    }
+  }
+  if (files.empty() || options.mScale < 1 || options.mReps < 1 ||
+      options.mWarmup < 0) {
+    usage();
+    return 2;
+  }
+
+  std::string flags;
+  for (const std::string &flag : options.mFlags)
+    flags += (flags.empty() ? "" : " ") + flag;
+  std::string json = "{\"interpreter\": " + quote(options.mInterpreter) +
+                     ", \"flags\": " + quote(flags) +
+                     ", \"scale\": " + std::to_string(options.mScale) +
+                     ", \"reps\": " + std::to_string(options.mReps) +
+                     ", \"benchmarks\": [";
+  bool failed = false;
+  for (size_t i = 0; i < files.size(); i++) {
+    std::string result = bench(options, files[i]);
+    failed |= result.find("\"error\"") != std::string::npos;
+    /// progress, the JSON itself may go to a file
+    fprintf(stderr, "%s\n", result.c_str());
+    json += (i ? ",\n  " : "\n  ") + result;
+  }
+  json += "\n]}\n";
+
+  FILE *out = options.mOut.empty() ? stdout : fopen(options.mOut.c_str(), "w");
+  if (!out) {
+    perror(options.mOut.c_str());
+    return 1;
+  }
+  fputs(json.c_str(), out);
+  if (out != stdout)
+    fclose(out);
+  return failed ? 1 : 0;
+}
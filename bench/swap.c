@@ -0,0 +1,34 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+/* pointer swaps through MALLOC'd cells: scale * 1000 allocations with
+   100 swaps each */
+void swap(int *a, int *b) {
+   int t = *a;
+   *a = *b;
+   *b = t;
+}
+
+int main() {
+   int n = GET() * 1000;
+   int s = 0;
+   int i;
+   int k;
+   int *x;
+   int *y;
+   for (k = 0; k < n; k = k + 1) {
+      x = (int *)MALLOC(sizeof(int));
+      y = (int *)MALLOC(sizeof(int));
+      *x = k;
+      *y = s;
+      for (i = 0; i < 100; i = i + 1)
+         swap(x, y);
+      s = (*x + *y) % 1000003;
+      FREE(x);
+      FREE(y);
+   }
+   PRINT(s);
+   return 0;
+}
@@ -7,22 +7,25 @@ make
 cd .. 
 # if no error occurs, we get a executable file
 ASTI="./build/ast-interpreter"
+# extra interpreter flags, e.g. ASTI_FLAGS=--bytecode to grade the bytecode engine
+ASTI_FLAGS=${ASTI_FLAGS:-}
 LIBCODE="./lib/builtin.c"
 
 TEST_DIR="./test"
 file_list=$(ls $TEST_DIR)
 # assume all the file in TEST_DIR is ``.c` file
 total=$(echo "$file_list"|wc -w)
+# and test33.c twice more with --snapshot, see below
+total=$(( $total + 2 ))
 correct=0
 echo "total test cases: $total"
 for file in $file_list; do
     # echo "testing $file"
     # result given by our interpreter
     filename="$TEST_DIR/$file"
-    ccode=$(cat $filename)
     # make $correct as the user input, you can change it if you like
     # in case you use "GET()" call, we need user input
-    actual=$(echo $correct|($ASTI "$ccode" 2>&1 >/dev/null)) 
+    actual=$(echo $correct|($ASTI $ASTI_FLAGS --file="$filename" 2>&1 >/dev/null)) 
     # result given by gcc
     gcc $filename $LIBCODE -o x.out
     expected=$(echo $correct|./x.out)
@@ -31,5 +34,22 @@ for file in $file_list; do
         correct=$(( $correct + 1 ))
     fi
 done
+# run test33 twice against one cache, the second run restores the snapshot
+# of its global initializers instead of running them; --stats tells which
+# one happened, so a restore that silently fell back to running them fails
+SNAPSHOT_TEST="$TEST_DIR/test33.c"
+SNAPSHOT_DIR=$(mktemp -d)
+gcc $SNAPSHOT_TEST $LIBCODE -o x.out
+expected=$(echo 0|./x.out)
+for run in ran restored; do
+    actual=$(echo 0|($ASTI $ASTI_FLAGS --ast-cache="$SNAPSHOT_DIR" --snapshot --stats --file="$SNAPSHOT_TEST" 2>&1 >"$SNAPSHOT_DIR/stats"))
+    if [[ "$actual" = "$expected" ]] && grep -qx "stats: init=$run" "$SNAPSHOT_DIR/stats"; then
+        echo "test33.c --snapshot (init $run) passed"
+        correct=$(( $correct + 1 ))
+    else
+        echo "test33.c --snapshot (init $run) failed"
+    fi
+done
+rm -r "$SNAPSHOT_DIR"
 rm x.out
 echo "$correct/$total"
\ No newline at end of file
@@ -0,0 +1,34 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int find(int x) {
+   int i;
+   for (i = 0; i < 100; i = i + 1) {
+      if (i * i >= x)
+         return i;
+   }
+   return -1;
+}
+
+int main() {
+   int a = 0;
+   int b = 0;
+   while (1) {
+      a = a + 1;
+      if (a > 10)
+         break;
+      if (a % 2 == 0)
+         continue;
+      b = b + a;
+   }
+   PRINT(b);
+   for (a = 0; a < 10; a = a + 1) {
+      if (a < 5) continue;
+      b = b + 1;
+   }
+   PRINT(b);
+   PRINT(find(50));
+   return 0;
+}
@@ -0,0 +1,22 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int main() {
+   int i;
+   int sum = 0;
+   int *a;
+   int *big;
+   for (i = 0; i < 2000; i = i + 1) {
+      a = (int *)MALLOC(sizeof(int) * 16);
+      *(a + 15) = i;
+      big = (int *)MALLOC(sizeof(int) * (200 + i % 50));
+      *big = *(a + 15);
+      sum = sum + *big % 7;
+      FREE(a);
+      FREE(big);
+   }
+   PRINT(sum);
+   return 0;
+}
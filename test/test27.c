@@ -0,0 +1,44 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int g[4];
+
+int sum(int *p, int n) {
+   int s = 0;
+   int *end = p + n;
+   while (p < end) {
+      s = s + *p;
+      p = p + 1;
+   }
+   return s;
+}
+
+void swap(int *a, int *b) {
+   int t = *a;
+   *a = *b;
+   *b = t;
+}
+
+int main() {
+   int a[5];
+   int x = 3;
+   int y = 4;
+   int i;
+   char c[3];
+   for (i = 0; i < 5; i = i + 1)
+      a[i] = i * 10;
+   PRINT(sum(a, 5));
+   PRINT(sum(&a[2], 3));
+   swap(&x, &y);
+   PRINT(x * 10 + y);
+   g[3] = 7;
+   PRINT(*(g + 3));
+   c[0] = 1;
+   c[1] = 2;
+   c[2] = 3;
+   PRINT(c[0] + c[1] * c[2]);
+   PRINT(&a[4] - &a[1]);
+   return 0;
+}
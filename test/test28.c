@@ -0,0 +1,38 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int sum(int n, int acc) {
+   if (n == 0)
+      return acc;
+   return sum(n - 1, acc + n % 7);
+}
+
+int isOdd(int n);
+
+int isEven(int n) {
+   if (n == 0)
+      return 1;
+   return isOdd(n - 1);
+}
+
+int isOdd(int n) {
+   if (n == 0)
+      return 0;
+   return (isEven(n - 1));
+}
+
+int fact(int n) {
+   if (n <= 1)
+      return 1;
+   return n * fact(n - 1);
+}
+
+int main() {
+   PRINT(sum(50000, 0));
+   PRINT(isEven(30001));
+   PRINT(isOdd(30001));
+   PRINT(fact(10));
+   return sum(10, 0) - 27;
+}
@@ -0,0 +1,33 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int g = 6 * 7 - 2;
+int a[4 * 2];
+
+int main() {
+   int i;
+   int s = 0;
+   int *p;
+   for (i = 0; i < 2 * 4; i = i + 1)
+      a[i] = i * (10 - 7) + sizeof(int);
+   if (0)
+      PRINT(1);
+   else
+      s = s + a[8 / 2 - 1];
+   while (0)
+      s = s + 1000;
+   if (1 && 2 > 1)
+      s = s + g;
+   for (i = 0; 3 < 2; i = i + 1)
+      s = s + 100;
+   s = s + -7 / 2 + -7 % 2 + ~0 + !0;
+   p = (int *)MALLOC(sizeof(int) * 2);
+   *(p + 1) = sizeof(char) + (1 + 2) * 3;
+   PRINT(s);
+   PRINT(*(p + 1));
+   PRINT(i);
+   FREE(p);
+   return 0;
+}
@@ -0,0 +1,91 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int total;
+int table[16];
+
+int square(int x) {
+   return x * x;
+}
+
+void bump(int *p, int by) {
+   *p = *p + by;
+   total = total + 1;
+}
+
+int sumTo(int n) {
+   int i;
+   int s = 0;
+   for (i = 0; i < n; i = i + 1) {
+      if (i % 7 == 3)
+         continue;
+      s = s + square(i % 10);
+   }
+   return s;
+}
+
+int grid(int n) {
+   int a[8];
+   int i;
+   int j;
+   int s = 0;
+   for (i = 0; i < 8; i = i + 1)
+      a[i] = i;
+   i = 0;
+   while (i < n) {
+      j = 0;
+      while (j < 8) {
+         s = s + a[j] * (i % 3);
+         j = j + 1;
+      }
+      i = i + 1;
+      if (s > 100000)
+         break;
+   }
+   return s + i;
+}
+
+int count(int n) {
+   if (n == 0)
+      return 0;
+   return count(n - 1);
+}
+
+int main() {
+   int i;
+   int k = 0;
+   int *p;
+   int local[4];
+   p = (int *)MALLOC(sizeof(int) * 4);
+   for (i = 0; i < 4; i = i + 1) {
+      p[i] = 0;
+      local[i] = i;
+   }
+   for (i = 0; i < 250; i = i + 1) {
+      bump(&k, i % 5);
+      bump(p + i % 4, 1);
+      table[i % 16] = table[i % 16] + square(i % 9);
+   }
+   PRINT(k);
+   PRINT(p[0] + p[1] * 10 + p[2] * 100 + p[3] * 1000);
+   PRINT(total);
+   PRINT(table[3] + table[15]);
+   PRINT(sumTo(500));
+   for (i = 0; i < 120; i = i + 1)
+      k = k + sumTo(i);
+   PRINT(k);
+   PRINT(grid(50));
+   PRINT(grid(400));
+   PRINT(count(300));
+   i = 0;
+   while (i < 1000) {
+      local[i % 4] = local[i % 4] + i;
+      i = i + 1;
+   }
+   PRINT(local[0] - local[3]);
+   PRINT(i);
+   FREE(p);
+   return 0;
+}
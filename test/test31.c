@@ -0,0 +1,91 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int g[40];
+int total;
+
+int sum(int *a, int n) {
+   int i;
+   int s = 0;
+   for (i = 0; i < n; i = i + 1)
+      s = s + a[i];
+   return s;
+}
+
+int firstDiff(int *a, int *b, int n) {
+   int i;
+   for (i = 0; i < n; i = i + 1) {
+      if (a[i] != b[i])
+         break;
+   }
+   return i;
+}
+
+int main() {
+   int a[37];
+   int b[37];
+   char c[19];
+   short h[11];
+   int *p;
+   int i;
+   int v = -3;
+   int n = 37;
+   for (i = 0; i < n; i = i + 1)
+      a[i] = v;
+   PRINT(sum(a, 37));
+   for (i = 0; i < 37; i = i + 1)
+      b[i] = i * i - 50;
+   for (i = 5; i <= 30; i = i + 1)
+      a[i] = b[i];
+   PRINT(sum(a, 37));
+   PRINT(i);
+   PRINT(firstDiff(a, b, 37));
+   PRINT(firstDiff(a + 5, b + 5, 26));
+   for (i = 0; i < 37; i = i + 1)
+      if (b[i] == 31)
+         break;
+   PRINT(i);
+   for (i = 0; i < 37; i = i + 1)
+      if (b[i] == 32)
+         break;
+   PRINT(i);
+   /* overlapping copy that repeats the first elements */
+   for (i = 0; i < 8; i = i + 1)
+      b[i + 0] = i;
+   p = b + 2;
+   for (i = 0; i < 20; i = i + 1)
+      p[i] = b[i];
+   PRINT(sum(b, 22));
+   /* overlapping copy backwards */
+   for (i = 0; i < 20; i = i + 1)
+      b[i] = p[i];
+   PRINT(sum(b, 22));
+   for (i = 0; i < 19; i = i + 1)
+      c[i] = 300 + i;
+   for (i = 3; i < 19; i = i + 1)
+      c[i] = 120;
+   PRINT(c[2] + c[3] + c[18]);
+   for (i = 0; i < 11; i = i + 1)
+      h[i] = -70000;
+   PRINT(h[0] + h[10]);
+   for (i = 0; i < 40; i = i + 1)
+      g[i] = i;
+   for (i = 0; i < 40; i = i + 1)
+      total = total + g[i];
+   PRINT(total);
+   p = (int *)MALLOC(sizeof(int) * 100);
+   for (i = 0; i < 100; i = i + 1)
+      p[i] = 7;
+   for (i = 0; i < 100; i = i + 1)
+      p[i] = p[i] + i;
+   PRINT(sum(p, 100));
+   i = 50;
+   for (; i < 10; i = i + 1)
+      p[i] = 0;
+   PRINT(i);
+   PRINT(firstDiff(p, p, 100));
+   FREE(p);
+   return 0;
+}
@@ -0,0 +1,56 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int calls;
+int scale = 3;
+
+int fib(int n) {
+   if (n < 2)
+      return n;
+   return fib(n - 1) + fib(n - 2);
+}
+
+int choose(int n, int k) {
+   if (k == 0)
+      return 1;
+   if (k == n)
+      return 1;
+   return choose(n - 1, k - 1) + choose(n - 1, k);
+}
+
+int gcd(int a, int b) {
+   if (b == 0)
+      return a;
+   return gcd(b, a % b);
+}
+
+int scaled(int n) {
+   return n * scale;
+}
+
+int counted(int n) {
+   calls = calls + 1;
+   return n + 1;
+}
+
+int twice(int n) {
+   return scaled(n) + scaled(n);
+}
+
+int main() {
+   int i;
+   int s = 0;
+   PRINT(fib(24));
+   PRINT(choose(20, 10));
+   PRINT(gcd(1071, 462));
+   for (i = 0; i < 5; i = i + 1) {
+      s = s + scaled(i) + counted(i) + twice(i);
+      scale = scale + 1;
+   }
+   PRINT(s);
+   PRINT(calls);
+   PRINT(fib(10) + fib(10));
+   return 0;
+}
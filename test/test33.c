@@ -0,0 +1,42 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int runs;
+int base = 7 * 6;
+int limit = 100 - 1;
+int table[64];
+char bytes[10];
+short halves[5];
+
+int fill(int n) {
+   int i;
+   int s = 0;
+   for (i = 0; i < n; i = i + 1) {
+      table[i] = i * i + base;
+      s = s + table[i];
+   }
+   return s;
+}
+
+int main() {
+   int *p;
+   int i;
+   /* main starts from the globals as initialized, not as the last run left them */
+   runs = runs + 1;
+   PRINT(runs);
+   PRINT(base + limit);
+   PRINT(table[10]);
+   PRINT(fill(64));
+   bytes[3] = 100;
+   halves[4] = 3000;
+   PRINT(bytes[3] + halves[4]);
+   p = (int *)MALLOC(4 * sizeof(int));
+   for (i = 0; i < 4; i = i + 1)
+      p[i] = table[i + 1];
+   PRINT(p[0] + p[3]);
+   FREE(p);
+   base = 0;
+   return 0;
+}